@@ -139,6 +139,50 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
   block->write_cnt++;
 }
 
+/** Reads CNT consecutive sectors starting at SECTOR from BLOCK.
+   BUFFERS[i] receives sector SECTOR + i and must have room for
+   BLOCK_SECTOR_SIZE bytes.  Drivers that can transfer several
+   sectors in one request do so; others read one sector at a time. */
+void
+block_read_multi (struct block *block, block_sector_t sector, size_t cnt,
+                  void *buffers[])
+{
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  if (block->ops->read_multi != NULL)
+    block->ops->read_multi (block->aux, sector, cnt, buffers);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read (block->aux, sector + i, buffers[i]);
+  block->read_cnt += cnt;
+}
+
+/** Writes CNT consecutive sectors starting at SECTOR to BLOCK.
+   BUFFERS[i] holds sector SECTOR + i.  Returns after the block 
+   device has acknowledged receiving all of them. */
+void
+block_write_multi (struct block *block, block_sector_t sector, size_t cnt,
+                   void *const buffers[])
+{
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (block->ops->write_multi != NULL)
+    block->ops->write_multi (block->aux, sector, cnt, buffers);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->write (block->aux, sector + i, buffers[i]);
+  block->write_cnt += cnt;
+}
+
 /** Returns the number of sectors in BLOCK. */
 block_sector_t
 block_size (struct block *block)
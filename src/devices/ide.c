@@ -85,7 +85,7 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -347,7 +347,7 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
+  select_sector (d, sec_no, 1);
   issue_pio_command (c, CMD_READ_SECTOR_RETRY);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
@@ -367,7 +367,7 @@ ide_write (void *d_, block_sector_t sec_no, const void *buffer)
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
+  select_sector (d, sec_no, 1);
   issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
   if (!wait_while_busy (d))
     PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
@@ -376,24 +376,89 @@ ide_write (void *d_, block_sector_t sec_no, const void *buffer)
   lock_release (&c->lock);
 }
 
+/** Most sectors moved by one PIO command.  (A sector count of 0
+   would mean 256.) */
+#define IDE_MULTI_MAX 255
+
+/** Reads CNT sectors starting at SEC_NO from disk D, with one
+   READ SECTORS command per IDE_MULTI_MAX sectors.  The disk
+   raises an interrupt as each sector becomes ready. */
+static void
+ide_read_multi (void *d_, block_sector_t sec_no, size_t cnt, 
+                void *buffers[])
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  size_t i, n;
+
+  lock_acquire (&c->lock);
+  for (; cnt > 0; sec_no += n, buffers += n, cnt -= n)
+    {
+      n = cnt < IDE_MULTI_MAX ? cnt : IDE_MULTI_MAX;
+      select_sector (d, sec_no, n);
+      issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+      for (i = 0; i < n; i++)
+        {
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu, 
+                   d->name, sec_no + i);
+          input_sector (c, buffers[i]);
+        }
+    }
+  lock_release (&c->lock);
+}
+
+/** Writes CNT sectors starting at SEC_NO to disk D, with one
+   WRITE SECTORS command per IDE_MULTI_MAX sectors.  Returns after
+   the disk has acknowledged receiving all of them. */
+static void
+ide_write_multi (void *d_, block_sector_t sec_no, size_t cnt,
+                 void *const buffers[])
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  size_t i, n;
+
+  lock_acquire (&c->lock);
+  for (; cnt > 0; sec_no += n, buffers += n, cnt -= n)
+    {
+      n = cnt < IDE_MULTI_MAX ? cnt : IDE_MULTI_MAX;
+      select_sector (d, sec_no, n);
+      issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+      for (i = 0; i < n; i++)
+        {
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu, 
+                   d->name, sec_no + i);
+          output_sector (c, buffers[i]);
+          sema_down (&c->completion_wait);
+        }
+    }
+  lock_release (&c->lock);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multi,
+    ide_write_multi
   };
 
 /** Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the number of sectors CNT to the disk's sector
+   selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= IDE_MULTI_MAX);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -5,6 +5,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 /**< number of bp caches */
 #define BIO_CACHE 48
@@ -105,9 +106,11 @@ bio_alloc (block_sector_t sec, short write)
  * - if not in the cache and have empty line, return empty liine.
  * - if not in the cache and cache is full, evict and return.
  * - if all lines are pinned, return -1.
+ * @param load if 0, do not read the sector from disk on a miss(the
+ * caller is going to overwrite all of it).
  */
 static int
-bio_fetch (block_sector_t sec, short write)
+bio_fetch (block_sector_t sec, short write, short load)
 {
   /* Must take the lock when executing bio_alloc. */
   ASSERT (lock_held_by_current_thread (&bplock));
@@ -160,7 +163,8 @@ bio_fetch (block_sector_t sec, short write)
 
     bmeta[ret].sec = sec;
     /* Read the page into cache */
-    block_read (fs_device, sec, bio_base + (BLOCK_SECTOR_SIZE * ret));
+    if (load)
+      block_read (fs_device, sec, bio_base + (BLOCK_SECTOR_SIZE * ret));
     /* Reset timestamp */
     bmeta[ret].timestamp = bio_ticks;
     bmeta[ret].dirty = write;
@@ -193,26 +197,24 @@ void bio_init (void) {
 struct bio_pack 
 bio_new (void)
 {
-  /* Acquire the lock, ad incur bio ticks. */
-  lock_acquire (&bplock);
-  ++bio_ticks;
-
   struct bio_pack pack = { .cache = NULL, .sec = 0};
 
-  /** allocate sector first. */
+  /** allocate sector first, the free map reads through the cache. */
   if (!free_map_allocate (1U, &pack.sec)) {
     /**< failure! */
-    lock_release (&bplock);
     return pack;
   }
 
+  /* Acquire the lock, ad incur bio ticks. */
+  lock_acquire (&bplock);
+  ++bio_ticks;
+
   int cno = bio_alloc (pack.sec, 1);
   if (cno == -1) {
     /** free the sector, return. */
+    lock_release (&bplock);
     free_map_release (pack.sec, 1U);
     pack.sec = 0;
-
-    lock_release (&bplock);
     return pack;
   }
 
@@ -227,7 +229,7 @@ bio_read_exec (block_sector_t sec)
 {
   lock_acquire (&bplock);
   ++bio_ticks;
-  int line = bio_fetch (sec, 0);
+  int line = bio_fetch (sec, 0, 1);
   if (line < 0) {
     /* Failure */
     lock_release (&bplock);
@@ -252,11 +254,11 @@ bio_read (block_sector_t sec)
 
 /** Fetch a sector for writing and pin it. */
 static char *
-bio_write_exec (block_sector_t sec)
+bio_write_exec (block_sector_t sec, short load)
 {
   lock_acquire (&bplock);
   ++bio_ticks;
-  int line = bio_fetch (sec, 1);
+  int line = bio_fetch (sec, 1, load);
 
   /* Help you pin the page. */
   if (line >= 0)
@@ -269,7 +271,18 @@ bio_write_exec (block_sector_t sec)
 char *
 bio_write (block_sector_t sec)
 {
-  char *ret = bio_write_exec (sec);
+  char *ret = bio_write_exec (sec, 1);
+  if (ret == NULL)
+    PANIC ("buffer full");
+  return ret;
+}
+
+/** Fetch a sector that will be entirely overwritten and pin it. Its
+   old content is not read from disk. */
+char *
+bio_overwrite (block_sector_t sec)
+{
+  char *ret = bio_write_exec (sec, 0);
   if (ret == NULL)
     PANIC ("buffer full");
   return ret;
@@ -296,6 +309,46 @@ bio_flush (void)
   lock_release (&bplock);
 }
 
+/** Write back dirty cached copies of CNT sectors from SEC, so
+ * that a read bypassing the cache sees their latest content.
+ */
+void
+bio_sync (block_sector_t sec, size_t cnt)
+{
+  lock_acquire (&bplock);
+  for (int i = 0; i < BIO_CACHE; ++i)
+    {
+      if (bmeta[i].timestamp != 0 && bmeta[i].dirty
+          && bmeta[i].sec >= sec && bmeta[i].sec < sec + cnt) {
+        block_write (fs_device, bmeta[i].sec, 
+                     bio_base + (BLOCK_SECTOR_SIZE * i));
+        bmeta[i].dirty = 0;
+      }
+    }
+  lock_release (&bplock);
+}
+
+/** Update cached copies of CNT sectors from SEC, after they have
+ * been written to disk bypassing the cache. 
+ * @param bufs bufs[i] holds the new content of sector sec + i.
+ */
+void
+bio_refresh (block_sector_t sec, size_t cnt, void *const bufs[])
+{
+  lock_acquire (&bplock);
+  for (int i = 0; i < BIO_CACHE; ++i)
+    {
+      if (bmeta[i].timestamp != 0 
+          && bmeta[i].sec >= sec && bmeta[i].sec < sec + cnt) {
+        memcpy ((char *) bio_base + (BLOCK_SECTOR_SIZE * i), 
+                bufs[bmeta[i].sec - sec], BLOCK_SECTOR_SIZE);
+        /* Same as the disk now. */
+        bmeta[i].dirty = 0;
+      }
+    }
+  lock_release (&bplock);
+}
+
 /** Pin a page in the buffer that will probably be used soon.
  * @return 1 if pin is successful.
  */
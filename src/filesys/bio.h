@@ -22,6 +22,9 @@ void bio_flush (void);
 struct bio_pack bio_new (void);
 const char *bio_read (block_sector_t sec);
 char *bio_write (block_sector_t sec);
+char *bio_overwrite (block_sector_t sec);
 int bio_free_sec (char *sec);
+void bio_sync (block_sector_t sec, size_t cnt);
+void bio_refresh (block_sector_t sec, size_t cnt, void *const bufs[]);
 
 #endif  /**< filesys/bio.h */
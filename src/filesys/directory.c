@@ -133,7 +133,7 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (name != NULL);
 
   if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+    *inode = inode_open (fs_mount_resolve (e.inode_sector));
   else
     *inode = NULL;
 
@@ -152,7 +152,7 @@ dir_sec (const struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   if (lookup (dir, name, &e, NULL))
-    return e.inode_sector;
+    return fs_mount_resolve (e.inode_sector);
   return -1;
 }
 
@@ -244,6 +244,16 @@ dir_remove (struct dir *dir, const char *name)
    contains no more entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
+{
+  block_sector_t sector;
+  return dir_readdir_ino (dir, name, &sector);
+}
+
+/** Like dir_readdir, but also stores the sector of the entry's
+   inode in *SECTOR. */
+bool
+dir_readdir_ino (struct dir *dir, char name[NAME_MAX + 1], 
+                 block_sector_t *sector)
 {
   struct dir_entry e;
 
@@ -253,6 +263,7 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
       if (e.in_use && strcmp (e.name, "..") && strcmp (e.name, "."))
         {
           strlcpy (name, e.name, NAME_MAX + 1);
+          *sector = e.inode_sector;
           return true;
         } 
     }
@@ -27,6 +27,8 @@ int dir_sec (const struct dir *, const char *name);
 bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+bool dir_readdir_ino (struct dir *, char name[NAME_MAX + 1], 
+                      block_sector_t *);
 
 /** Telling and seeking */
 int dir_tell (const struct dir *dir);
@@ -9,6 +9,7 @@ struct file
     struct inode *inode;        /**< File's inode. */
     off_t pos;                  /**< Current position. */
     bool deny_write;            /**< Has file_deny_write() been called? */
+    bool direct;                /**< Bypass the buffer cache? */
   };
 
 /** Opens a file for the given INODE, of which it takes ownership,
@@ -24,6 +25,7 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->direct = false;
       return file;
     }
   else
@@ -40,6 +42,14 @@ file_writable (struct file *file)
   return !file->deny_write;
 }
 
+/** Makes sector-aligned reads and writes of FILE bypass the 
+   buffer cache if DIRECT is true, see inode_read_direct. */
+void
+file_set_direct (struct file *file, bool direct)
+{
+  file->direct = direct;
+}
+
 /** Opens and returns a new file for the same inode as FILE.
    Returns a null pointer if unsuccessful. */
 struct file *
@@ -77,7 +87,9 @@ file_read (struct file *file, void *buffer, off_t size)
 {
   if (!inode_is_file (file->inode))
     return -1;
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read = file->direct
+                     ? inode_read_direct (file->inode, buffer, size, file->pos)
+                     : inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -92,6 +104,8 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 {
   if (!inode_is_file (file->inode))
     return -1;
+  if (file->direct)
+    return inode_read_direct (file->inode, buffer, size, file_ofs);
   return inode_read_at (file->inode, buffer, size, file_ofs);
 }
 
@@ -107,7 +121,9 @@ file_write (struct file *file, const void *buffer, off_t size)
 {
   if (!inode_is_file (file->inode))
     return -1;
-  off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+  off_t bytes_written = file->direct
+    ? inode_write_direct (file->inode, buffer, size, file->pos)
+    : inode_write_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_written;
   return bytes_written;
 }
@@ -125,9 +141,29 @@ file_write_at (struct file *file, const void *buffer, off_t size,
 {
   if (inode_typ (file->inode) != INODE_FILE)
     return -1;
+  if (file->direct)
+    return inode_write_direct (file->inode, buffer, size, file_ofs);
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/** Copies SIZE bytes from SRC into DST, starting at the current
+   position of each, without copying through a caller's buffer.
+   Returns the number of bytes actually copied, which may be less 
+   than SIZE if end of SRC is reached, or -1 if either is not a 
+   regular file.
+   Advances both positions by the number of bytes copied. */
+off_t
+file_copy (struct file *dst, struct file *src, off_t size)
+{
+  if (!inode_is_file (src->inode) || !inode_is_file (dst->inode))
+    return -1;
+  off_t bytes_copied = inode_copy_range (src->inode, src->pos, 
+                                         dst->inode, dst->pos, size);
+  src->pos += bytes_copied;
+  dst->pos += bytes_copied;
+  return bytes_copied;
+}
+
 /** Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -18,6 +18,7 @@ off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+off_t file_copy (struct file *dst, struct file *src, off_t size);
 
 /** Preventing writes. */
 void file_deny_write (struct file *);
@@ -26,6 +27,9 @@ void file_allow_write (struct file *);
 /* Check writablility */
 bool file_writable (struct file *);
 
+/** Direct I/O. */
+void file_set_direct (struct file *, bool);
+
 /** File position. */
 void file_seek (struct file *, off_t);
 off_t file_tell (struct file *);
@@ -5,6 +5,8 @@
 #include <string.h>
 #include "filesys/file.h"
 #include "filesys/free-map.h"
+#include "filesys/refcnt.h"
+#include "filesys/tmpfs.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "filesys/bio.h"
@@ -15,6 +17,19 @@ struct block *fs_device;
 
 static void do_format (void);
 
+/** A directory served by a tmpfs. */
+struct mount
+  {
+    block_sector_t dir;                 /**< Mount point on disk */
+    block_sector_t root;                /**< Root directory in tmpfs */
+  };
+
+/**< Most tmpfs mounts at once. */
+#define MOUNT_MAX 4
+
+static struct mount mounts[MOUNT_MAX];  /**< Mount table */
+static int mount_cnt;                   /**< Entries in mounts */
+
 /** Initializes the file system module.
    If FORMAT is true, reformats the file system. */
 void
@@ -37,6 +52,7 @@ filesys_init (bool format)
     do_format ();
 
   free_map_open ();
+  refcnt_open ();
 }
 
 /** Shuts down the file system module, writing any unwritten data
@@ -44,6 +60,9 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  inode_flush_all ();
+  inode_reap_wait ();
+  refcnt_close ();
   free_map_flush ();
   free_map_close ();
   bio_flush ();
@@ -110,6 +129,7 @@ do_format (void)
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
+  refcnt_create ();
   free_map_close ();
   printf ("done.\n");
 }
@@ -213,6 +233,106 @@ filesys_leave (int from, const char *path, char *tmp)
   return filesys_leave (from, path + iter, tmp);
 }
 
+/** Returns the directory to use in place of sec: the root of the
+   tmpfs mounted on sec, or sec itself. */
+block_sector_t
+fs_mount_resolve (block_sector_t sec)
+{
+  for (int i = 0; i < mount_cnt; ++i)
+    {
+      if (mounts[i].dir == sec)
+        return mounts[i].root;
+    }
+  return sec;
+}
+
+/** Returns 1 if sec is the root of a mounted tmpfs. */
+static int
+fs_mount_root (block_sector_t sec)
+{
+  for (int i = 0; i < mount_cnt; ++i)
+    {
+      if (mounts[i].root == sec)
+        return 1;
+    }
+  return 0;
+}
+
+/** Allocate an inode for a new entry of directory dir, from the
+   tmpfs or the disk that holds dir. */
+static int
+fs_alloc (block_sector_t dir, block_sector_t *sec)
+{
+  if (tmpfs_is (dir))
+    return tmpfs_alloc (sec);
+  return free_map_allocate (1U, sec);
+}
+
+/** Undo fs_alloc. */
+static void
+fs_release (block_sector_t sec)
+{
+  if (tmpfs_is (sec))
+    tmpfs_release (sec);
+  else
+    free_map_release (sec, 1);
+}
+
+/** Serve directory path, which is created if missing, from a new
+ * empty tmpfs. Its entries on disk are hidden until shutdown.
+ * @return 1 if successful.
+ */
+int 
+fs_mount_tmpfs (const char *path)
+{
+  if (mount_cnt == MOUNT_MAX)
+    return 0;
+
+  struct file *file = fs_open (path);
+  if (file == NULL && fs_mkdir (path, 0))
+    file = fs_open (path);
+  if (file == NULL)
+    return 0;
+
+  /* Mount on a disk directory other than the root only. */
+  struct inode *ino = file_get_inode (file);
+  const block_sector_t sec = inode_num (ino);
+  int ret = 0;
+  if (inode_typ (ino) != INODE_DIR || sec == ROOT_DIR_SECTOR 
+      || tmpfs_is (sec) || fs_mount_resolve (sec) != sec)
+    goto done;
+
+  /* The root of the tmpfs shares its parent with the mount point. */
+  struct dir *dir = dir_open (inode_reopen (ino));
+  const int parent = dir_sec (dir, "..");
+  dir_close (dir);
+  if (parent == INVALID_SECTOR)
+    goto done;
+
+  block_sector_t root;
+  if (!tmpfs_alloc (&root))
+    goto done;
+  if (!inode_create (root, 0, INODE_DIR)) {
+    tmpfs_release (root);
+    goto done;
+  }
+  dir = dir_open (inode_open (root));
+  ret = dir != NULL && dir_add (dir, ".", root) 
+        && dir_add (dir, "..", parent);
+  if (ret) {
+    mounts[mount_cnt].dir = sec;
+    mounts[mount_cnt].root = root;
+    mount_cnt++;
+  } else if (dir != NULL) {
+    inode_remove (dir_get_inode (dir));
+  }
+  dir_close (dir);
+
+done:
+  file_close (file);
+  return ret;
+}
+
 /** Returns the current working dir of thread. */
 static int
 fs_get_pwd (void)
@@ -263,6 +383,13 @@ fs_remove (const char *name)
     return 0;
   }
 
+  /* A mounted tmpfs stays until shutdown. */
+  if (fs_mount_root (inode_num (del))) {
+    inode_close (del);
+    dir_close (dir);
+    return 0;
+  }
+
   int ret = 0;
   switch (inode_typ (del)) {
     case INODE_FILE: {
@@ -324,12 +451,71 @@ fs_create (const char *name, off_t initial_size)
 
   block_sector_t sec = 0;
   int ret = (
-    free_map_allocate (1U, &sec) &&
+    fs_alloc (dest, &sec) &&
     inode_create (sec, initial_size, INODE_FILE) &&
     dir_add (dir, tmp, sec)
   );
   if (ret == 0&& sec != 0) 
-    free_map_release (sec, 1);
+    fs_release (sec);
+  dir_close (dir);
+
+  return ret;
+}
+
+/** Create a file named name that shares all data blocks with src,
+ * see inode_clone.
+ * @param name may be absolute or relative.
+ */
+int 
+fs_reflink (struct inode *src, const char *name)
+{
+  if (inode_typ (src) != INODE_FILE || tmpfs_is (inode_num (src)))
+    return 0;
+
+  int absolute = 0;
+  if (*name == '/') {
+    absolute = 1;
+    /* Abolute path. */
+    while (*name == '/') {
+      ++name;
+    }
+  }
+
+  /* Starting directory. */
+  int from = absolute ? ROOT_DIR_SECTOR : fs_get_pwd ();
+
+  /* Walk to destination */
+  char tmp[NAME_MAX + 2];  /**< buffer */
+  int dest;                /**< sector of destination */
+  dest = filesys_leave (from, name, tmp);
+
+  if (dest == INVALID_SECTOR || tmpfs_is (dest)) {
+    /* Fail, a clone must live on the same disk. */
+    return 0;
+  }
+
+  /* Open directory. */
+  struct inode *ino = inode_open (dest);
+  if (ino == NULL || inode_typ (ino) != INODE_DIR) {
+    inode_close (ino);
+    return 0;
+  }
+  struct dir *dir = dir_open (ino);
+  ASSERT (dir != NULL);
+
+  /* inode_clone releases sec itself on failure. */
+  block_sector_t sec = 0;
+  int ret = (
+    free_map_allocate (1U, &sec) &&
+    inode_clone (src, sec)
+  );
+  if (ret && !dir_add (dir, tmp, sec)) {
+    /* Drop the clone and its block references. */
+    struct inode *clone = inode_open (sec);
+    inode_remove (clone);
+    inode_close (clone);
+    ret = 0;
+  }
   dir_close (dir);
 
   return ret;
@@ -372,12 +558,12 @@ fs_mkdir (const char *name, off_t initial_size)
 
   block_sector_t sec = 0;
   int ret = (
-    free_map_allocate (1U, &sec) &&
+    fs_alloc (dest, &sec) &&
     inode_create (sec, initial_size, INODE_DIR) &&
     dir_add (dir, tmp, sec)
   );
   if (ret == 0 && sec != 0) 
-    free_map_release (sec, 1);
+    fs_release (sec);
   dir_close (dir);
 
   if (ret == 0)
@@ -4,12 +4,16 @@
 #include <stdbool.h>
 #include "threads/synch.h"
 #include "filesys/off_t.h"
+#include "devices/block.h"
 
 /** Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /**< Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /**< Root directory file inode sector. */
+#define REFCNT_SECTOR 2         /**< Refcount file inode sector. */
 #define INVALID_SECTOR -1       /**< Used to denote a sector not exists. */
 
+struct inode;
+
 /** Block device that contains the file system. */
 struct block *fs_device;
 
@@ -30,5 +34,8 @@ int fs_mkdir (const char *name, off_t initial_size);
 struct file *fs_open (const char *name);
 int fs_remove (const char *name);
 int fs_chdir (const char *name);
+int fs_reflink (struct inode *src, const char *name);
+int fs_mount_tmpfs (const char *path);
+block_sector_t fs_mount_resolve (block_sector_t);
 
 #endif /**< filesys/filesys.h */
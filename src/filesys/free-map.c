@@ -1,96 +1,387 @@
 #include "filesys/free-map.h"
-#include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesys/bio.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/** The free map has one bit per sector, set if the sector is in use.
+   It is split into groups of one bitmap sector each, which are read
+   through the buffer cache only when a group is searched or changed.
+   A summary of the free sectors in every group comes first and is
+   the only part kept in memory, so mounting reads a few sectors no
+   matter the size of the disk.
+
+   On disk, the free map file is a run of sectors from FREE_MAP_START:
+   the summary (struct free_map_header followed by one free count per
+   group) in hdr_cnt sectors, then one bitmap sector per group. */
+
+/**< First sector of the free map file data. */
+#define FREE_MAP_START (REFCNT_SECTOR + 1)
+
+/**< Sectors tracked by one bitmap sector. */
+#define GROUP_BITS (BLOCK_SECTOR_SIZE * 8)
+
+/**< Identifies a free map summary. */
+#define FREE_MAP_MAGIC 0x46524545
+
+/** Start of the summary. */
+struct free_map_header
+  {
+    uint32_t magic;                     /**< FREE_MAP_MAGIC */
+    uint32_t sector_cnt;                /**< Sectors on the device */
+    uint32_t group_cnt;                 /**< Number of groups */
+    uint16_t free[];                    /**< Free sectors per group */
+  };
 
 static struct file *free_map_file;   /**< Free map file. */
-static struct bitmap *free_map;      /**< Free map, one bit per sector. */
+static struct lock free_map_lock;    /**< Protects the free map. */
+static uint32_t sector_cnt;          /**< Sectors on the device. */
+static uint32_t group_cnt;           /**< Number of groups. */
+static uint32_t hdr_cnt;             /**< Sectors of the summary. */
+static uint16_t *group_free;         /**< Free sectors per group. */
+static size_t reserved_cnt;          /**< Free sectors promised to
+                                          free_map_reserve callers. */
+
+/** Returns the sector holding the bitmap of group g. */
+static block_sector_t
+group_sector (uint32_t g)
+{
+  return FREE_MAP_START + hdr_cnt + g;
+}
+
+/** Returns true if bit i of bits is set. */
+static inline bool
+bit_test (const uint8_t *bits, size_t i)
+{
+  return (bits[i / 8] >> (i % 8)) & 1;
+}
+
+/** Sets cnt bits of bits from start on to value. The layout matches
+   lib/kernel/bitmap.c on a little-endian machine. */
+static void
+bits_set (uint8_t *bits, size_t start, size_t cnt, bool value)
+{
+  for (size_t i = start; i < start + cnt; ++i)
+    {
+      if (value)
+        bits[i / 8] |= 1 << (i % 8);
+      else
+        bits[i / 8] &= ~(1 << (i % 8));
+    }
+}
+
+/** Returns the index of the first run of cnt clear bits among the
+   GROUP_BITS bits of bits, or GROUP_BITS if there is none. */
+static size_t
+bits_scan (const uint8_t *bits, size_t cnt)
+{
+  size_t run = 0;
+  for (size_t i = 0; i < GROUP_BITS; ++i)
+    {
+      /* Skip bytes that are full. */
+      if (i % 8 == 0 && bits[i / 8] == 0xff) {
+        run = 0;
+        i += 7;
+        continue;
+      }
+      run = bit_test (bits, i) ? 0 : run + 1;
+      if (run == cnt)
+        return i + 1 - cnt;
+    }
+  return GROUP_BITS;
+}
+
+/** Marks cnt sectors from sector on as used or free. The sectors
+   may span groups. Must hold free_map_lock. */
+static void
+free_map_mark (block_sector_t sector, size_t cnt, bool used)
+{
+  ASSERT (sector + cnt <= sector_cnt);
+  while (cnt > 0)
+    {
+      const uint32_t g = sector / GROUP_BITS;
+      const size_t ofs = sector % GROUP_BITS;
+      const size_t n = cnt < GROUP_BITS - ofs ? cnt : GROUP_BITS - ofs;
+
+      uint8_t *bits = (uint8_t *) bio_write (group_sector (g));
+      for (size_t i = ofs; i < ofs + n; ++i)
+        ASSERT (bit_test (bits, i) != used);
+      bits_set (bits, ofs, n, used);
+      if (!bio_unpin_sec ((const char *) bits))
+        PANIC ("bio unpin");
+      group_free[g] += used ? -(int) n : (int) n;
+
+      sector += n;
+      cnt -= n;
+    }
+}
 
 /** Initializes the free map. */
 void
-free_map_init (void) 
+free_map_init (void)
+{
+  lock_init (&free_map_lock);
+}
+
+/** Returns the number of free sectors. Must hold free_map_lock. */
+static size_t
+free_map_free_cnt (void)
 {
-  free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
-    PANIC ("bitmap creation failed--file system device is too large");
-  bitmap_mark (free_map, FREE_MAP_SECTOR);
-  bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  size_t cnt = 0;
+  for (uint32_t g = 0; g < group_cnt; ++g)
+    cnt += group_free[g];
+  return cnt;
+}
+
+/** Allocates CNT consecutive sectors, drawing on the reservations if
+   RESERVED is set, and leaving them alone otherwise. */
+static bool
+free_map_alloc (size_t cnt, block_sector_t *sectorp, bool reserved)
+{
+  bool success = false;
+  if (cnt == 0 || cnt > GROUP_BITS)
+    return false;
+
+  lock_acquire (&free_map_lock);
+  ASSERT (!reserved || reserved_cnt >= cnt);
+  if (!reserved && free_map_free_cnt () < reserved_cnt + cnt) {
+    lock_release (&free_map_lock);
+    return false;
+  }
+  for (uint32_t g = 0; g < group_cnt && !success; ++g)
+    {
+      /* The summary spares reading groups that cannot fit cnt. */
+      if (group_free[g] < cnt)
+        continue;
+      const uint8_t *bits = (const uint8_t *) bio_read (group_sector (g));
+      const size_t idx = bits_scan (bits, cnt);
+      if (!bio_unpin_sec ((const char *) bits))
+        PANIC ("bio unpin");
+      if (idx == GROUP_BITS)
+        continue;
+
+      *sectorp = g * GROUP_BITS + idx;
+      free_map_mark (*sectorp, cnt, true);
+      success = true;
+    }
+  if (success && reserved)
+    reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+  return success;
 }
 
 /** Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP. A run never crosses a group. Sectors
+   reserved with free_map_reserve are not handed out.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-#ifndef FILESYS
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
-    }
-#endif
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  return free_map_alloc (cnt, sectorp, false);
+}
+
+/** Like free_map_allocate, but takes the CNT sectors out of those
+   reserved earlier. A single sector can always be had this way. */
+bool
+free_map_allocate_reserved (size_t cnt, block_sector_t *sectorp)
+{
+  return free_map_alloc (cnt, sectorp, true);
+}
+
+/** Sets CNT free sectors aside, so that a later
+   free_map_allocate_reserved of them cannot fail for lack of space.
+   Returns false if fewer than CNT unreserved sectors are free. */
+bool
+free_map_reserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  const bool success = free_map_free_cnt () >= reserved_cnt + cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/** Gives back CNT sectors reserved with free_map_reserve. */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
 }
 
 /** Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-#ifndef FILESYS
-  bitmap_write (free_map, free_map_file);
-#endif
+  lock_acquire (&free_map_lock);
+  free_map_mark (sector, cnt, false);
+  lock_release (&free_map_lock);
+}
+
+/** Compare two sectors, for sort. */
+static int
+sector_cmp (const void *a_, const void *b_, void *aux UNUSED)
+{
+  const block_sector_t *a = a_;
+  const block_sector_t *b = b_;
+  return *a < *b ? -1 : *a > *b;
+}
+
+/** Makes the CNT sectors in SECTORS available for use. SECTORS is
+   sorted in place, so that contiguous sectors are released as one
+   run while holding the free map lock once. */
+void
+free_map_release_batch (block_sector_t *sectors, size_t cnt)
+{
+  size_t i, run;
+
+  sort (sectors, cnt, sizeof *sectors, sector_cmp, NULL);
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < cnt; i += run)
+    {
+      for (run = 1; i + run < cnt; run++)
+        if (sectors[i + run] != sectors[i] + run)
+          break;
+      free_map_mark (sectors[i], run, false);
+    }
+  lock_release (&free_map_lock);
 }
 
-/** Flush the free map file to disk. */
+/** Flush the free map summary into the buffer cache. The bitmap
+   sectors are already there. */
 void
 free_map_flush (void)
 {
-  ASSERT (bitmap_write (free_map, free_map_file));
+  const size_t bytes = sizeof (struct free_map_header)
+                       + group_cnt * sizeof (uint16_t);
+
+  lock_acquire (&free_map_lock);
+  for (uint32_t i = 0; i < hdr_cnt; ++i)
+    {
+      char *dat = bio_write (FREE_MAP_START + i);
+      if (i == 0) {
+        struct free_map_header *h = (struct free_map_header *) dat;
+        h->magic = FREE_MAP_MAGIC;
+        h->sector_cnt = sector_cnt;
+        h->group_cnt = group_cnt;
+      }
+
+      /* Counts continue over the following sectors. */
+      const size_t start = i * BLOCK_SECTOR_SIZE;
+      for (size_t b = start > sizeof (struct free_map_header)
+                      ? start : sizeof (struct free_map_header);
+           b < bytes && b < start + BLOCK_SECTOR_SIZE; b += 2)
+        {
+          const uint32_t g = (b - sizeof (struct free_map_header)) / 2;
+          memcpy (dat + b - start, &group_free[g], sizeof (uint16_t));
+        }
+      if (!bio_unpin_sec (dat))
+        PANIC ("bio unpin");
+    }
+  lock_release (&free_map_lock);
+}
+
+/** Writes the free map summary and the bitmap sectors changed since
+   they were last written to disk, so that sectors allocated so far
+   stay allocated after a crash. */
+void
+free_map_sync (void)
+{
+  free_map_flush ();
+  bio_sync (FREE_MAP_START, hdr_cnt + group_cnt);
 }
 
-/** Opens the free map file and reads it from disk. */
+/** Computes the layout of the free map for the file system device. */
+static void
+free_map_layout (void)
+{
+  sector_cnt = block_size (fs_device);
+  group_cnt = DIV_ROUND_UP (sector_cnt, GROUP_BITS);
+  hdr_cnt = DIV_ROUND_UP (sizeof (struct free_map_header)
+                          + group_cnt * sizeof (uint16_t),
+                          BLOCK_SECTOR_SIZE);
+  free (group_free);
+  group_free = calloc (group_cnt, sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("free map summary allocation failed");
+}
+
+/** Opens the free map file and reads its summary from disk. */
 void
-free_map_open (void) 
+free_map_open (void)
 {
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_read (free_map, free_map_file))
+  free_map_layout ();
+
+  const struct free_map_header *h = (const struct free_map_header *)
+                                    bio_read (FREE_MAP_START);
+  bool valid = h->magic == FREE_MAP_MAGIC && h->sector_cnt == sector_cnt;
+  if (!bio_unpin_sec ((const char *) h))
+    PANIC ("bio unpin");
+  if (!valid)
+    PANIC ("can't read free map, reformat with -f");
+  if (file_read_at (free_map_file, group_free,
+                    group_cnt * sizeof (uint16_t),
+                    sizeof (struct free_map_header))
+      != (off_t) (group_cnt * sizeof (uint16_t)))
     PANIC ("can't read free map");
 }
 
 /** Writes the free map to disk and closes the free map file. */
 void
-free_map_close (void) 
+free_map_close (void)
 {
+  free_map_flush ();
   file_close (free_map_file);
 }
 
-/** Creates a new free map file on disk and writes the free map to
-   it. */
+/** Creates a new free map file on disk, with all sectors free but
+   the system inodes and the free map itself. */
 void
-free_map_create (void) 
+free_map_create (void)
 {
-  /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), INODE_FILE))
-    PANIC ("free map creation failed");
+  free_map_layout ();
 
-  /* Write bitmap to file. */
+  /* Empty bitmaps. Bits past the end of the device count as used. */
+  for (uint32_t g = 0; g < group_cnt; ++g)
+    {
+      const uint32_t first = g * GROUP_BITS;
+      const uint32_t n = sector_cnt - first < GROUP_BITS
+                         ? sector_cnt - first : GROUP_BITS;
+      uint8_t *bits = (uint8_t *) bio_overwrite (group_sector (g));
+      memset (bits, 0, BLOCK_SECTOR_SIZE);
+      bits_set (bits, n, GROUP_BITS - n, true);
+      if (!bio_unpin_sec ((const char *) bits))
+        PANIC ("bio unpin");
+      group_free[g] = n;
+    }
+
+  lock_acquire (&free_map_lock);
+  free_map_mark (FREE_MAP_SECTOR, 1, true);
+  free_map_mark (ROOT_DIR_SECTOR, 1, true);
+  free_map_mark (REFCNT_SECTOR, 1, true);
+  free_map_mark (FREE_MAP_START, hdr_cnt + group_cnt, true);
+  lock_release (&free_map_lock);
+  free_map_flush ();
+
+  /* Create inode over the run of sectors written above. */
+  if (!inode_create_extent (FREE_MAP_SECTOR, FREE_MAP_START,
+                            hdr_cnt + group_cnt, INODE_FILE))
+    PANIC ("free map creation failed");
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
-    PANIC ("can't write free map");
 }
@@ -6,13 +6,17 @@
 #include "devices/block.h"
 
 void free_map_init (void);
-void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
 void free_map_flush (void);
+void free_map_sync (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_reserved (size_t, block_sector_t *);
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
 void free_map_release (block_sector_t, size_t);
+void free_map_release_batch (block_sector_t *, size_t);
 
 #endif /**< filesys/free-map.h */
@@ -7,6 +7,7 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -67,6 +68,22 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/** Moves the blocks of file ARGV[1] into runs of consecutive
+   sectors. */
+void
+fsutil_defrag (char **argv)
+{
+  const char *file_name = argv[1];
+  struct file *file;
+
+  printf ("Defragmenting '%s'...\n", file_name);
+  file = filesys_open (file_name);
+  if (file == NULL)
+    PANIC ("%s: open failed", file_name);
+  printf ("%d blocks moved.\n", inode_defrag (file_get_inode (file)));
+  file_close (file);
+}
+
 /** Extracts a ustar-format tar archive from the scratch block
    device into the Pintos file system. */
 void
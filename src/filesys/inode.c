@@ -2,11 +2,13 @@
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stdio.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 #include "common.h"
 
@@ -397,6 +399,8 @@ inode_length (const struct inode *inode)
 
 #else  /**< Add your own inode impl! */
 #include "bio.h"
+#include "refcnt.h"
+#include "tmpfs.h"
 
 /** inode magic number */
 #define INODE_MAGIC 0x10203040
@@ -412,13 +416,32 @@ inode_length (const struct inode *inode)
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    short type;           /**< Type of file */
+    uint8_t type;         /**< Type of file */
+    uint8_t flags;        /**< Layout flags, see INODE_F_* */
     short nlink;          /**< Number of links to inode */
     off_t size;           /**< Size of file (bytes) */
-    int addrs[125];       /**< Data block addresses */
+    union
+      {
+        int addrs[125];   /**< Data block addresses */
+        uint8_t inline_data[125 * sizeof (int)];
+                          /**< File data, if INODE_F_INLINE is set */
+      };
     unsigned magic;       /**< Magic number */
   };
 
+/**< Data is stored in inline_data rather than in data blocks. */
+#define INODE_F_INLINE 0x1
+
+/**< Largest file (or directory) that is stored inline */
+#define INLINE_SIZE (125 * sizeof (int))
+
+/** Returns 1 if the data of di lives inside the inode sector. */
+static inline int
+inode_is_inline (const struct inode_disk *di)
+{
+  return (di->flags & INODE_F_INLINE) != 0;
+}
+
 /**< size of sum of direct sectors */
 #define DIRECT_SIZE (123 * BLOCK_SECTOR_SIZE)
 
@@ -431,6 +454,14 @@ struct inode_disk
 /**< maximum size of file */
 #define MAXFILE (DIRECT_SIZE + SINGLE_INDIR_SIZE + DOUBLY_INDIR_SIZE)
 
+/**< Block indexes where the indirect ranges start and end. */
+#define SINGLE_FIRST (DIRECT_SIZE / BLOCK_SECTOR_SIZE)
+#define DOUBLY_FIRST (SINGLE_FIRST + SINGLE_INDIR_SIZE / BLOCK_SECTOR_SIZE)
+#define MAXBLOCK (MAXFILE / BLOCK_SECTOR_SIZE)
+
+/**< Number of written sectors an inode remembers for fsync. */
+#define INODE_DIRTY_MAX 32
+
 /** In-memory inode. */
 struct inode 
   {
@@ -441,6 +472,11 @@ struct inode
     int deny_write_cnt;                 /**< 0: writes ok, >0: deny writes. */
     struct inode_disk *data;            /**< Inode content. */
     struct lock lk;                     /**< inode lock */
+    struct list delayed;                /**< Blocks without a sector yet */
+    int delayed_cnt;                    /**< Length of delayed list */
+    block_sector_t dirty[INODE_DIRTY_MAX]; /**< Sectors written since sync */
+    int dirty_cnt;                      /**< -1: unknown, walk block map */
+    bool meta_dirty;                    /**< Size or block map changed */
   };
 
 /** Indirect block */
@@ -449,25 +485,80 @@ struct indirect_block
     block_sector_t addrs[128];          /**< Address to other blocks. */
   };
 
-/** Deallocate all sectors occupied by an inode. */
+/**< Number of delayed blocks an inode may hold before writeback. */
+#define DELAYED_MAX 64
+
+/** A written data block whose sector has not been allocated yet. */
+struct delayed_block
+  {
+    struct list_elem elem;              /**< Element in inode->delayed */
+    int idx;                            /**< Block index in the file */
+    char data[BLOCK_SECTOR_SIZE];       /**< Block content */
+  };
+
+/**< Number of sectors the reaper hands to the free map at once. */
+#define REAP_BATCH 256
+
+/** Sectors waiting to be released to the free map. */
+struct reap_batch
+  {
+    block_sector_t secs[REAP_BATCH];    /**< Sectors to release */
+    size_t cnt;                         /**< Number of sectors in secs */
+  };
+
+/** Release the sectors collected in b. */
 static void
-inode_deallocate (struct inode *ino)
+reap_flush (struct reap_batch *b)
 {
-  if (ino == NULL)
-    PANIC ("invalid argument");
-  ASSERT (lock_held_by_current_thread (&ino->lk));
+  if (b->cnt > 0) {
+    free_map_release_batch (b->secs, b->cnt);
+    b->cnt = 0;
+  }
+}
+
+/** Queue sec for release, or release it at once if b is NULL. */
+static void
+reap_add (struct reap_batch *b, block_sector_t sec)
+{
+  if (b == NULL) {
+    free_map_release (sec, 1U);
+    return;
+  }
+  b->secs[b->cnt++] = sec;
+  if (b->cnt == REAP_BATCH)
+    reap_flush (b);
+}
 
+/** Queue data sector sec for release, unless a clone still owns
+   it. */
+static void
+reap_data (struct reap_batch *b, block_sector_t sec)
+{
+  if (!refcnt_dec (sec))
+    reap_add (b, sec);
+}
+
+/** Deallocate all sectors occupied by the inode at sector. Freed 
+   sectors are collected in b, see reap_add. Data sectors shared
+   with a clone only lose a reference. */
+static void
+inode_deallocate (block_sector_t sector, struct reap_batch *b)
+{
   /* Fetch and pin the sector */
-  const struct inode_disk *di = bio_read (ino->sector); 
+  const struct inode_disk *di = bio_read (sector); 
   if (di == NULL) {
     PANIC ("buffer full");
   }
 
+  /* Inline data occupies no sector other than the inode itself. */
+  if (inode_is_inline (di))
+    goto dealloc_done;
+
   /* For each direct page, destroy */
   for (int i = 0; i < 123; ++i)
     {
       if (di->addrs[i] != INODE_INVALID) {
-        free_map_release (di->addrs[i], 1U);
+        reap_data (b, di->addrs[i]);
       }
     }
   
@@ -477,12 +568,12 @@ inode_deallocate (struct inode *ino)
       const struct indirect_block *ind = bio_read (di->addrs[123]);
       for (int i = 0; i < 128; ++i) {
         if (ind->addrs[i] != INODE_INVALID)
-          free_map_release (ind->addrs[i], 1U);
+          reap_data (b, ind->addrs[i]);
       }
 
       if (!bio_free_sec (ind))
         PANIC ("bio free");
-      free_map_release (di->addrs[123], 1U);
+      reap_add (b, di->addrs[123]);
     }
 
   /* Free doubly indirect blocks. */
@@ -499,24 +590,25 @@ inode_deallocate (struct inode *ino)
 
         for (int k = 0; k < 128; ++k) {
           if (second->addrs[k] != INODE_INVALID)
-            free_map_release (second->addrs[k], 1U);
+            reap_data (b, second->addrs[k]);
         }
         
         if (!bio_free_sec (second))
           PANIC ("bio free");
-        free_map_release (first->addrs[i], 1U);
+        reap_add (b, first->addrs[i]);
       }
 
       if (!bio_free_sec (first))
         PANIC ("bio free");
-      free_map_release (di->addrs[124], 1U);
+      reap_add (b, di->addrs[124]);
     }
 
+dealloc_done:
   /* Finish. */ 
   if (!bio_free_sec (di)) {
     PANIC ("free sec");
   }
-  free_map_release (ino->sector, 1U);
+  reap_add (b, sector);
 }
 
 /** Return the offset in a sector. */
@@ -526,6 +618,67 @@ sec_off (off_t offset)
   return offset % BLOCK_SECTOR_SIZE;
 }
 
+/** Returns the first block index at or after idx that may hold
+   data. Unmapped indirect blocks are skipped as a whole, so a hole
+   costs at most one lookup per indirect block it spans. 
+   Returns idx itself if block idx is mapped, MAXBLOCK if no block
+   after idx is. */
+static int
+inode_hole_end (const struct inode_disk *di, int idx)
+{
+  ASSERT (!inode_is_inline (di));
+
+  /* Direct blocks. */
+  while (idx < SINGLE_FIRST && di->addrs[idx] == INODE_INVALID)
+    idx++;
+  if (idx < SINGLE_FIRST)
+    return idx;
+
+  /* Singly indirect block. */
+  if (idx < DOUBLY_FIRST) {
+    if (di->addrs[123] == INODE_INVALID) {
+      idx = DOUBLY_FIRST;
+    } else {
+      const struct indirect_block *ind = 
+        (const struct indirect_block *) bio_read (di->addrs[123]);
+      while (idx < DOUBLY_FIRST 
+             && ind->addrs[idx - SINGLE_FIRST] == INODE_INVALID)
+        idx++;
+      if (!bio_unpin_sec ((const char *) ind))
+        PANIC ("bio unpin");
+      if (idx < DOUBLY_FIRST)
+        return idx;
+    }
+  }
+
+  /* Doubly indirect block. */
+  if (di->addrs[124] == INODE_INVALID)
+    return MAXBLOCK;
+  const struct indirect_block *first = 
+    (const struct indirect_block *) bio_read (di->addrs[124]);
+  while (idx < MAXBLOCK) 
+    {
+      const int i = (idx - DOUBLY_FIRST) / 128;
+      const int end = DOUBLY_FIRST + (i + 1) * 128;
+      if (first->addrs[i] == INODE_INVALID) {
+        idx = end;
+        continue;
+      }
+      const struct indirect_block *second = 
+        (const struct indirect_block *) bio_read (first->addrs[i]);
+      while (idx < end 
+             && second->addrs[(idx - DOUBLY_FIRST) % 128] == INODE_INVALID)
+        idx++;
+      if (!bio_unpin_sec ((const char *) second))
+        PANIC ("bio unpin");
+      if (idx < end)
+        break;
+    }
+  if (!bio_unpin_sec ((const char *) first))
+    PANIC ("bio unpin");
+  return idx;
+}
+
 /** Seek and read a page into buffer. 
  * @param di disk inode representing an inode
  * @param buf buffer to read data to
@@ -544,6 +697,23 @@ inode_seek_read (const struct inode_disk *di, char *buf, off_t offset,
     /* Seek outside the file */
     return 0;
   }
+
+  if (inode_is_inline (di)) {
+    /* Whole file lives in the inode sector, no more lookups. */
+    off_t bytes = di->size - offset;
+    bytes = bytes > size ? size : bytes;
+    memcpy (buf, di->inline_data + offset, bytes);
+    return bytes;
+  }
+
+  /* Zero a whole hole at once rather than sector by sector. */
+  const int hole_end = inode_hole_end (di, offset / BLOCK_SECTOR_SIZE);
+  if (hole_end > offset / BLOCK_SECTOR_SIZE) {
+    off_t bytes = (off_t) hole_end * BLOCK_SECTOR_SIZE - offset;
+    bytes = bytes > size ? size : bytes;
+    memset (buf, 0, bytes);
+    return bytes;
+  }
   
   if (offset < DIRECT_SIZE) {
     int idx = offset / BLOCK_SECTOR_SIZE;
@@ -663,6 +833,109 @@ indirect_block_init (struct indirect_block *ind)
   }
 }
 
+/** Returns the sector holding block idx of a file, INODE_INVALID if 
+   the block has not been allocated. */
+static int
+inode_lookup_sec (const struct inode_disk *di, int idx)
+{
+  ASSERT (!inode_is_inline (di));
+  ASSERT (idx >= 0);
+  if (idx < 123)
+    return di->addrs[idx];
+
+  /* Singly indirect block. */
+  idx -= 123;
+  if (idx < 128) {
+    if (di->addrs[123] == INODE_INVALID)
+      return INODE_INVALID;
+    const struct indirect_block *ind = 
+      (const struct indirect_block *) bio_read (di->addrs[123]);
+    int ret = ind->addrs[idx];
+    if (!bio_unpin_sec (ind))
+      PANIC ("bio unpin");
+    return ret;
+  }
+
+  /* Doubly indirect block. */
+  idx -= 128;
+  ASSERT (idx < 128 * 128);
+  if (di->addrs[124] == INODE_INVALID)
+    return INODE_INVALID;
+  const struct indirect_block *first = 
+    (const struct indirect_block *) bio_read (di->addrs[124]);
+  int isec = first->addrs[idx / 128];
+  if (!bio_unpin_sec (first))
+    PANIC ("bio unpin");
+  if (isec == INODE_INVALID)
+    return INODE_INVALID;
+  const struct indirect_block *second = 
+    (const struct indirect_block *) bio_read (isec);
+  int ret = second->addrs[idx % 128];
+  if (!bio_unpin_sec (second))
+    PANIC ("bio unpin");
+  return ret;
+}
+
+/** Make sure the indirect block at *slot exists, allocate one if not.
+   @return a pinned, writable indirect block, NULL if disk is full. */
+static struct indirect_block *
+indirect_block_get (int *slot)
+{
+  struct indirect_block *ind;
+  if (*slot == INODE_INVALID) {
+    if (!free_map_allocate (1U, (block_sector_t *) slot))
+      return NULL;
+    ind = (struct indirect_block *) bio_overwrite (*slot);
+    indirect_block_init (ind);
+    return ind;
+  }
+  return (struct indirect_block *) bio_write (*slot);
+}
+
+/** Point block idx of a file at sector sec, allocating indirect 
+   blocks on the way. sec may be INODE_INVALID, which only builds the
+   path to the block.
+   @return 1 on success, 0 if disk is full. */
+static int
+inode_set_sec (struct inode_disk *di, int idx, int sec)
+{
+  ASSERT (!inode_is_inline (di));
+  ASSERT (idx >= 0);
+  if (idx < 123) {
+    di->addrs[idx] = sec;
+    return 1;
+  }
+
+  /* Singly indirect block. */
+  idx -= 123;
+  if (idx < 128) {
+    struct indirect_block *ind = indirect_block_get (&di->addrs[123]);
+    if (ind == NULL)
+      return 0;
+    ind->addrs[idx] = sec;
+    if (!bio_unpin_sec (ind))
+      PANIC ("bio unpin");
+    return 1;
+  }
+
+  /* Doubly indirect block. */
+  idx -= 128;
+  ASSERT (idx < 128 * 128);
+  struct indirect_block *first = indirect_block_get (&di->addrs[124]);
+  if (first == NULL)
+    return 0;
+  struct indirect_block *second = 
+    indirect_block_get ((int *) &first->addrs[idx / 128]);
+  if (!bio_unpin_sec (first))
+    PANIC ("bio unpin");
+  if (second == NULL)
+    return 0;
+  second->addrs[idx % 128] = sec;
+  if (!bio_unpin_sec (second))
+    PANIC ("bio unpin");
+  return 1;
+}
+
 /** Write to a singly indirect block.
  * @param sec sector of the singly indirect block, INODE_INVALID if
  * need to be allocated. 
@@ -792,6 +1065,37 @@ double_indir_write (int *sec, const char *buf, off_t offset, off_t size)
   return ret;
 }
 
+/** Move the inline data of di into a newly allocated data sector, 
+ * and switch di to block mapping.
+ * @return 1 on success, 0 if disk is full.
+ */
+static int
+inode_promote (struct inode_disk *di)
+{
+  ASSERT (inode_is_inline (di));
+
+  int dsec = INODE_INVALID;
+  if (di->size > 0) {
+    /* Only a non-empty file needs a data sector. */
+    if (!free_map_allocate (1U, &dsec))
+      return 0;
+
+    char *dat = bio_write (dsec);
+    memcpy (dat, di->inline_data, INLINE_SIZE);
+    memset (dat + INLINE_SIZE, 0, BLOCK_SECTOR_SIZE - INLINE_SIZE);
+    if (!bio_unpin_sec (dat))
+      PANIC ("bio unpin");
+  }
+
+  for (int i = 0; i < 125; ++i)
+    {
+      di->addrs[i] = INODE_INVALID;
+    }
+  di->addrs[0] = dsec;
+  di->flags &= ~INODE_F_INLINE;
+  return 1;
+}
+
 /** Seek and read a page into buffer. 
  * @param di disk inode representing an inode
  * @param buf buffer to read data to
@@ -807,6 +1111,13 @@ inode_seek_write (struct inode_disk *di, const char *buf, off_t offset,
     /* Cannot write outside of maxfile. */
     return 0;
   }
+
+  if (inode_is_inline (di)) {
+    /* Caller promotes the inode if the write does not fit. */
+    ASSERT (offset + size <= (off_t) INLINE_SIZE);
+    memcpy (di->inline_data + offset, buf, size);
+    return size;
+  }
   const off_t sec_of = sec_off (offset);
   /* bytes = min(bytes, size); */
   const off_t bytes = (size >= (BLOCK_SECTOR_SIZE - sec_of)) 
@@ -850,6 +1161,376 @@ inode_seek_write (struct inode_disk *di, const char *buf, off_t offset,
   return double_indir_write (&di->addrs[124], buf, offset, size);
 }
 
+/** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
+ *                          Copy-on-Write
+  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
+
+/** Give block idx of ino a sector of its own if it shares one with
+   a clone, so that a write does not show through in the clone.
+   @return false if the disk is full. */
+static bool
+inode_unshare (struct inode *ino, struct inode_disk *di, int idx)
+{
+  /* The refcount file never shares, and looking would recurse. */
+  if (ino->sector == REFCNT_SECTOR || inode_is_inline (di))
+    return true;
+  const int sec = inode_lookup_sec (di, idx);
+  if (sec == INODE_INVALID || !refcnt_shared (sec))
+    return true;
+
+  block_sector_t copy;
+  if (!free_map_allocate (1U, &copy))
+    return false;
+  const char *from = bio_read (sec);
+  char *to = bio_overwrite (copy);
+  memcpy (to, from, BLOCK_SECTOR_SIZE);
+  if (!bio_unpin_sec (to) || !bio_unpin_sec (from))
+    PANIC ("bio unpin");
+  if (!inode_set_sec (di, idx, copy)) {
+    free_map_release (copy, 1U);
+    return false;
+  }
+
+  /* The other owners may have gone away meanwhile. */
+  if (!refcnt_dec (sec))
+    free_map_release (sec, 1U);
+  ino->meta_dirty = true;
+  return true;
+}
+
+/** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
+ *                          Dirty Tracking
+  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
+
+/** Remember that sector sec of ino has been written. Once more
+   than INODE_DIRTY_MAX sectors are written, give up and let
+   inode_sync walk the whole block map. */
+static void
+inode_mark_sec (struct inode *ino, block_sector_t sec)
+{
+  if (ino->dirty_cnt < 0)
+    return;
+  for (int i = 0; i < ino->dirty_cnt; ++i)
+    {
+      if (ino->dirty[i] == sec)
+        return;
+    }
+  if (ino->dirty_cnt == INODE_DIRTY_MAX) {
+    ino->dirty_cnt = -1;
+    return;
+  }
+  ino->dirty[ino->dirty_cnt++] = sec;
+}
+
+/** Remember that block idx of ino has been written. Inline data
+   lives in the inode sector and delayed blocks are not on disk yet,
+   neither needs an entry. */
+static void
+inode_mark_block (struct inode *ino, const struct inode_disk *di, int idx)
+{
+  if (inode_is_inline (di) || ino->dirty_cnt < 0)
+    return;
+  const int sec = inode_lookup_sec (di, idx);
+  if (sec != INODE_INVALID)
+    inode_mark_sec (ino, sec);
+}
+
+/** Write back the indirect blocks of di, and their data blocks too
+   if data is set. */
+static void
+inode_sync_map (const struct inode_disk *di, bool data)
+{
+  if (inode_is_inline (di))
+    return;
+  if (data) {
+    for (int i = 0; i < 123; ++i)
+      {
+        if (di->addrs[i] != INODE_INVALID)
+          bio_sync (di->addrs[i], 1);
+      }
+  }
+
+  /* Singly indirect block. */
+  if (di->addrs[123] != INODE_INVALID) {
+    const struct indirect_block *ind = 
+      (const struct indirect_block *) bio_read (di->addrs[123]);
+    for (int i = 0; data && i < 128; ++i)
+      {
+        if (ind->addrs[i] != INODE_INVALID)
+          bio_sync (ind->addrs[i], 1);
+      }
+    if (!bio_unpin_sec ((const char *) ind))
+      PANIC ("bio unpin");
+    bio_sync (di->addrs[123], 1);
+  }
+
+  /* Doubly indirect block. */
+  if (di->addrs[124] != INODE_INVALID) {
+    const struct indirect_block *first = 
+      (const struct indirect_block *) bio_read (di->addrs[124]);
+    for (int i = 0; i < 128; ++i)
+      {
+        if (first->addrs[i] == INODE_INVALID)
+          continue;
+        const struct indirect_block *second = 
+          (const struct indirect_block *) bio_read (first->addrs[i]);
+        for (int k = 0; data && k < 128; ++k)
+          {
+            if (second->addrs[k] != INODE_INVALID)
+              bio_sync (second->addrs[k], 1);
+          }
+        if (!bio_unpin_sec ((const char *) second))
+          PANIC ("bio unpin");
+        bio_sync (first->addrs[i], 1);
+      }
+    if (!bio_unpin_sec ((const char *) first))
+      PANIC ("bio unpin");
+    bio_sync (di->addrs[124], 1);
+  }
+}
+
+/** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
+ *                        Delayed Allocation
+  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
+
+/** Returns 1 if writes to new blocks of ino may be delayed. The free
+   map itself must always be written in place. */
+static int
+inode_delayable (const struct inode *ino, const struct inode_disk *di)
+{
+  return ino->sector != FREE_MAP_SECTOR && di->type == INODE_FILE
+         && !inode_is_inline (di);
+}
+
+/** Order delayed blocks by their index in the file. */
+static bool
+delayed_less (const struct list_elem *a, const struct list_elem *b,
+              void *aux UNUSED)
+{
+  return list_entry (a, struct delayed_block, elem)->idx
+         < list_entry (b, struct delayed_block, elem)->idx;
+}
+
+/** Returns the delayed block idx of ino, NULL if not found. */
+static struct delayed_block *
+inode_delayed_find (struct inode *ino, int idx)
+{
+  struct list_elem *e;
+  for (e = list_begin (&ino->delayed); e != list_end (&ino->delayed);
+       e = list_next (e))
+    {
+      struct delayed_block *db = list_entry (e, struct delayed_block, elem);
+      if (db->idx == idx)
+        return db;
+      if (db->idx > idx)
+        break;
+    }
+  return NULL;
+}
+
+/** Returns the first delayed block of ino at or after block idx,
+   NULL if there is none. */
+static struct delayed_block *
+inode_delayed_next (struct inode *ino, int idx)
+{
+  struct list_elem *e;
+  for (e = list_begin (&ino->delayed); e != list_end (&ino->delayed);
+       e = list_next (e))
+    {
+      struct delayed_block *db = list_entry (e, struct delayed_block, elem);
+      if (db->idx >= idx)
+        return db;
+    }
+  return NULL;
+}
+
+/** Throw away all delayed blocks of ino, e.g. when it is removed,
+   and give back the sectors reserved for them. */
+static void
+inode_delayed_discard (struct inode *ino)
+{
+  while (!list_empty (&ino->delayed))
+    {
+      struct list_elem *e = list_pop_front (&ino->delayed);
+      free (list_entry (e, struct delayed_block, elem));
+    }
+  free_map_unreserve (ino->delayed_cnt);
+  ino->delayed_cnt = 0;
+}
+
+/** Write into a block without allocating its sector. The indirect
+   blocks on its path are built now and a sector is reserved for it,
+   so that writeback cannot run out of space. Falls back to
+   inode_seek_write if the block is already on disk, or if it cannot
+   be reserved, which then reports a disk full as a short write.
+   @return number of bytes written. */
+static off_t
+inode_delayed_write (struct inode *ino, struct inode_disk *di,
+                     const char *buf, off_t offset, off_t size)
+{
+  if (offset >= MAXFILE || size <= 0)
+    return 0;
+  const int idx = offset / BLOCK_SECTOR_SIZE;
+  const off_t sec_of = sec_off (offset);
+  /* bytes = min(bytes, size); */
+  const off_t bytes = (size >= (BLOCK_SECTOR_SIZE - sec_of)) 
+                    ? (BLOCK_SECTOR_SIZE - sec_of) : size;
+
+  struct delayed_block *db = inode_delayed_find (ino, idx);
+  if (db == NULL) {
+    if (inode_lookup_sec (di, idx) != INODE_INVALID)
+      return inode_seek_write (di, buf, offset, size);
+
+    /* New block, keep it in memory for now. */
+    if (!inode_set_sec (di, idx, INODE_INVALID))
+      return 0;
+    ino->meta_dirty = true;
+    db = malloc (sizeof (struct delayed_block));
+    if (db == NULL)
+      return inode_seek_write (di, buf, offset, size);
+    if (!free_map_reserve (1)) {
+      free (db);
+      return inode_seek_write (di, buf, offset, size);
+    }
+    db->idx = idx;
+    memset (db->data, 0, BLOCK_SECTOR_SIZE);
+    list_insert_ordered (&ino->delayed, &db->elem, delayed_less, NULL);
+    ino->delayed_cnt++;
+  }
+
+  memcpy (db->data + sec_of, buf, bytes);
+  return bytes;
+}
+
+/** Allocate sectors for all delayed blocks of ino, in runs as long
+   as the free map allows, and move them into the buffer cache. The
+   sectors were reserved and the indirect blocks built by
+   inode_delayed_write, so this cannot fail. */
+static void
+inode_delayed_writeback (struct inode *ino, struct inode_disk *di)
+{
+  ASSERT (lock_held_by_current_thread (&ino->lk));
+  struct list_elem *e;
+
+  ino->meta_dirty = true;
+  while (!list_empty (&ino->delayed))
+    {
+      /* Longest run of free sectors, up to the number of blocks. */
+      size_t run = ino->delayed_cnt;
+      block_sector_t start;
+      while (!free_map_allocate_reserved (run, &start))
+        {
+          if (run == 1)
+            PANIC ("reserved sector missing");
+          run /= 2;
+        }
+
+      for (size_t i = 0; i < run; ++i)
+        {
+          e = list_pop_front (&ino->delayed);
+          struct delayed_block *db = list_entry (e, struct delayed_block,
+                                                 elem);
+          inode_set_sec (di, db->idx, start + i);
+          inode_mark_sec (ino, start + i);
+          char *dat = bio_overwrite (start + i);
+          memcpy (dat, db->data, BLOCK_SECTOR_SIZE);
+          if (!bio_unpin_sec (dat))
+            PANIC ("bio unpin");
+          free (db);
+          ino->delayed_cnt--;
+        }
+    }
+}
+
+/** Write back delayed blocks of ino. */
+static void
+inode_flush_delayed (struct inode *ino)
+{
+  ASSERT (lock_held_by_current_thread (&ino->lk));
+  if (ino->delayed_cnt == 0)
+    return;
+  struct inode_disk *di = (struct inode_disk *) bio_write (ino->sector);
+  inode_delayed_writeback (ino, di);
+  if (!bio_unpin_sec (di))
+    PANIC ("bio unpin");
+}
+
+/** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
+ *                        Background Reaper
+  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
+
+/** A removed inode whose sectors are not yet released. */
+struct reap_entry
+  {
+    struct list_elem elem;              /**< Element in reap_list */
+    block_sector_t sector;              /**< Sector of the inode */
+  };
+
+static struct list reap_list;           /**< Inodes waiting for reaper */
+static struct lock reap_lock;           /**< Protects reap_list, reaping */
+static struct condition reap_work;      /**< Signaled on new entries */
+static struct condition reap_idle;      /**< Signaled when list drained */
+static bool reaping;                    /**< Reaper has an entry in hand */
+static struct reap_batch reap_secs;     /**< Used by reaper thread only */
+
+/** Hand the sectors of a removed inode to the reaper. */
+static void
+inode_reap (block_sector_t sector)
+{
+  struct reap_entry *re = malloc (sizeof (struct reap_entry));
+  if (re == NULL) {
+    /* Out of memory, do it ourselves. */
+    inode_deallocate (sector, NULL);
+    return;
+  }
+  re->sector = sector;
+
+  lock_acquire (&reap_lock);
+  list_push_back (&reap_list, &re->elem);
+  cond_signal (&reap_work, &reap_lock);
+  lock_release (&reap_lock);
+}
+
+/** Reaper thread, releases sectors of removed inodes. */
+static void
+inode_reaper (void *aux UNUSED)
+{
+  for (;;)
+    {
+      lock_acquire (&reap_lock);
+      if (list_empty (&reap_list))
+        {
+          /* Out of work, release what we collected and sleep. */
+          lock_release (&reap_lock);
+          reap_flush (&reap_secs);
+          lock_acquire (&reap_lock);
+          while (list_empty (&reap_list))
+            {
+              reaping = false;
+              cond_broadcast (&reap_idle, &reap_lock);
+              cond_wait (&reap_work, &reap_lock);
+            }
+        }
+      reaping = true;
+      struct reap_entry *re = list_entry (list_pop_front (&reap_list),
+                                          struct reap_entry, elem);
+      lock_release (&reap_lock);
+
+      inode_deallocate (re->sector, &reap_secs);
+      free (re);
+    }
+}
+
+/** Wait until the reaper released all removed inodes. */
+void
+inode_reap_wait (void)
+{
+  lock_acquire (&reap_lock);
+  while (!list_empty (&reap_list) || reaping)
+    cond_wait (&reap_idle, &reap_lock);
+  lock_release (&reap_lock);
+}
+
 /** List of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
 static struct list open_inodes;
@@ -878,6 +1559,18 @@ inode_init (void)
 
   list_init (&open_inodes);
   lock_init (&inode_list_lock);
+
+  tmpfs_init ();
+
+  /* Start the reaper. */
+  list_init (&reap_list);
+  lock_init (&reap_lock);
+  cond_init (&reap_work);
+  cond_init (&reap_idle);
+  reaping = false;
+  if (thread_create ("reaper", PRI_DEFAULT, inode_reaper, NULL) 
+      == TID_ERROR)
+    PANIC ("cannot create reaper");
 }
 
 /** Initializes an inode with LENGTH bytes of data and
@@ -888,20 +1581,30 @@ inode_init (void)
 bool 
 inode_create (block_sector_t sec, off_t size, int tp)
 {
+  if (tmpfs_is (sec))
+    return tmpfs_create (sec, size, tp);
+
   /* Fetch and pin the sector. */
   struct inode_disk *di = bio_write (sec);
   if (di == NULL)
     return false;
 
   di->type = tp;
+  di->flags = 0;
   di->size = size;
   /* TODO: set a reasonable nlink. */
   di->nlink = 1;
 
-  for (int i = 0; i < 125; ++i)
-    {
-      di->addrs[i] = INODE_INVALID;
-    }
+  if (size <= (off_t) INLINE_SIZE) {
+    /* Small files and directories start out inline. */
+    di->flags |= INODE_F_INLINE;
+    memset (di->inline_data, 0, INLINE_SIZE);
+  } else {
+    for (int i = 0; i < 125; ++i)
+      {
+        di->addrs[i] = INODE_INVALID;
+      }
+  }
   di->magic = INODE_MAGIC;
 
   /* Unpin the page, done. */
@@ -911,6 +1614,35 @@ inode_create (block_sector_t sec, off_t size, int tp)
   return true;
 }
 
+/** Writes to SECTOR an inode of type TP whose CNT data blocks are
+   the sectors from START on, which the caller has already allocated
+   and filled. Used for the free map, which cannot allocate its own
+   blocks. Indirect blocks still come from the free map.
+   Returns true if successful. */
+bool
+inode_create_extent (block_sector_t sector, block_sector_t start,
+                     size_t cnt, int tp)
+{
+  bool success = true;
+  struct inode_disk *di = (struct inode_disk *) bio_overwrite (sector);
+  di->type = tp;
+  di->flags = 0;
+  di->size = cnt * BLOCK_SECTOR_SIZE;
+  di->nlink = 1;
+  for (int i = 0; i < 125; ++i)
+    {
+      di->addrs[i] = INODE_INVALID;
+    }
+  di->magic = INODE_MAGIC;
+
+  for (size_t i = 0; i < cnt && success; ++i)
+    success = inode_set_sec (di, i, start + i);
+
+  if (!bio_unpin_sec ((const char *) di))
+    PANIC ("bio unpin");
+  return success;
+}
+
 /** Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
@@ -948,6 +1680,11 @@ inode_open (block_sector_t sector)
   inode->deny_write_cnt = 0;
   inode->removed = false;
   lock_init (&inode->lk);
+  list_init (&inode->delayed);
+  inode->delayed_cnt = 0;
+  /* Sectors written before this open are unknown. */
+  inode->dirty_cnt = -1;
+  inode->meta_dirty = true;
 
   /* Do not fetch the sector for now. */
 #if 0
@@ -998,11 +1735,17 @@ inode_close (struct inode *inode)
       /* Remove from inode list and release lock. */
       list_remove (&inode->elem);
  
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      /* Deallocate blocks if removed. Delayed blocks of a removed
+         inode never reach the disk; the rest is left to the reaper. */
+      if (inode->removed && tmpfs_is (inode->sector))
+        tmpfs_release (inode->sector);
+      else if (inode->removed) 
         {
-          inode_deallocate (inode);
+          inode_delayed_discard (inode);
+          inode_reap (inode->sector);
         }
+      else
+        inode_flush_delayed (inode);
 
       lock_release (&inode->lk);
       lock_release (&inode_list_lock);
@@ -1033,6 +1776,16 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
+  if (offset < 0 || size < 0)
+    return 0;
+
+  /* tmpfs keeps the data in memory. */
+  if (tmpfs_is (inode->sector)) {
+    lock_acquire (&inode->lk);
+    bytes_read = tmpfs_read (inode->sector, buffer, size, offset);
+    lock_release (&inode->lk);
+    return bytes_read;
+  }
 
   /* Fetch and pin the page(DO NOT WRITE inode->data) */
   const struct inode_disk *sec = bio_read (inode->sector);
@@ -1049,10 +1802,27 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   if (offset >= sec->size)
     goto read_done;
 
+  /* Never read past end of file. */
+  if (size > sec->size - offset)
+    size = sec->size - offset;
+
   /* Seek offset */
   while (size > 0) {
-    /* call reader. */
-    const off_t bread = inode_seek_read (sec, buffer, offset, size);
+    /* call reader, unless the block is still in memory. */
+    const int idx = offset / BLOCK_SECTOR_SIZE;
+    struct delayed_block *db = inode_delayed_next (inode, idx);
+    off_t bread;
+    if (db != NULL && db->idx == idx) {
+      bread = BLOCK_SECTOR_SIZE - sec_off (offset);
+      bread = bread > size ? size : bread;
+      memcpy (buffer, db->data + sec_off (offset), bread);
+    } else {
+      /* Holes may be skipped in bulk, but not past a delayed block. */
+      off_t limit = size;
+      if (db != NULL && (off_t) db->idx * BLOCK_SECTOR_SIZE - offset < limit)
+        limit = (off_t) db->idx * BLOCK_SECTOR_SIZE - offset;
+      bread = inode_seek_read (sec, buffer, offset, limit);
+    }
     ASSERT (bread <= size);
 
     /* Advance. */
@@ -1080,7 +1850,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   off_t bytes_wrt = 0;
-  if (offset >= MAXFILE)
+  if (offset < 0 || size < 0 || offset >= MAXFILE)
     return 0;
 
   /* Acquire the inode lock. */
@@ -1092,6 +1862,14 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     return 0;
   }
 
+  /* tmpfs keeps the data in memory, and has smaller files. */
+  if (tmpfs_is (inode->sector)) {
+    if (offset < TMPFS_MAXFILE)
+      bytes_wrt = tmpfs_write (inode->sector, buffer_, size, offset);
+    lock_release (&inode->lk);
+    return bytes_wrt;
+  }
+
   /* Fetch and pin inode_disk. */
   struct inode_disk *di = bio_write (inode->sector);
   
@@ -1100,11 +1878,33 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     PANIC ("not inode_disk");
   }
 
+  /* Switch to block mapping if the inline area overflows. */
+  if (inode_is_inline (di) && offset + size > (off_t) INLINE_SIZE) {
+    if (!inode_promote (di))
+      goto wrt_done;
+    inode->meta_dirty = true;
+    inode_mark_block (inode, di, 0);
+  }
+
+  /* New blocks of a regular file get their sectors at writeback. */
+  const int delay = inode_delayable (inode, di);
   while (size >= 0) {
-    const off_t bwrt = inode_seek_write (di, buffer_, offset, size);
+    const int idx = offset / BLOCK_SECTOR_SIZE;
+    const bool mapped = inode_is_inline (di) 
+                        || inode_lookup_sec (di, idx) != INODE_INVALID;
+    if (size > 0 && mapped && !inode_unshare (inode, di, idx))
+      break;
+    const off_t bwrt = delay 
+                     ? inode_delayed_write (inode, di, buffer_, offset, size)
+                     : inode_seek_write (di, buffer_, offset, size);
     ASSERT (bwrt <= size);
     if (bwrt == 0) /* Disk full, abort */
       break;
+
+    /* Remember what fsync has to write. */
+    if (!mapped)
+      inode->meta_dirty = true;
+    inode_mark_block (inode, di, idx);
     
     /* Advance */
     bytes_wrt += bwrt;
@@ -1114,7 +1914,14 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   }
 
   /* Update the size of file. */
-  di->size = offset > di->size ? offset : di->size;
+  if (offset > di->size) {
+    di->size = offset;
+    inode->meta_dirty = true;
+  }
+
+  /* Do not let delayed blocks pile up. */
+  if (inode->delayed_cnt >= DELAYED_MAX)
+    inode_delayed_writeback (inode, di);
   
 wrt_done:
   if (!bio_unpin_sec (di))
@@ -1123,6 +1930,359 @@ wrt_done:
   return bytes_wrt;
 }
 
+/**< Most sectors moved by one direct I/O request. */
+#define DIRECT_MAX 8
+
+/** Looks for blocks of ino from block idx on that can bypass the
+   cache: up to min(cnt, DIRECT_MAX) blocks stored in consecutive 
+   sectors, the first of which is stored into *sec. A run to be
+   written stops at sectors shared with a clone.
+   @return number of such blocks, 0 if block idx must go through the
+   cache (inline data, hole, delayed or shared block). */
+static int
+inode_direct_run (struct inode *ino, const struct inode_disk *di, int idx,
+                  int cnt, int *sec, bool write)
+{
+  if (inode_is_inline (di))
+    return 0;
+
+  int n;
+  for (n = 0; n < cnt && n < DIRECT_MAX; ++n) {
+    if (inode_delayed_find (ino, idx + n) != NULL)
+      break;
+    const int s = inode_lookup_sec (di, idx + n);
+    if (s == INODE_INVALID || (n > 0 && s != *sec + n))
+      break;
+    if (write && refcnt_shared (s))
+      break;
+    if (n == 0)
+      *sec = s;
+  }
+  return n;
+}
+
+/** Reads SIZE bytes from INODE into BUFFER, starting at OFFSET,
+   moving whole blocks straight from the disk into BUFFER with one
+   multi-sector request per run of consecutive sectors. Dirty cached
+   copies are written back first. Unaligned requests and blocks not
+   on disk go through inode_read_at.
+   Returns the number of bytes actually read. */
+off_t
+inode_read_direct (struct inode *inode, void *buffer_, off_t size,
+                   off_t offset)
+{
+  if (sec_off (offset) != 0 || sec_off (size) != 0 
+      || tmpfs_is (inode->sector))
+    return inode_read_at (inode, buffer_, size, offset);
+
+  char *buffer = buffer_;
+  off_t bytes_read = 0;
+  while (size > 0) {
+    lock_acquire (&inode->lk);
+    const struct inode_disk *di = (const struct inode_disk *) 
+                                  bio_read (inode->sector);
+    const off_t left = di->size - offset;
+    const off_t want = size < left ? size : left;
+    int sec, n = 0;
+    if (want >= BLOCK_SECTOR_SIZE)
+      n = inode_direct_run (inode, di, offset / BLOCK_SECTOR_SIZE,
+                            want / BLOCK_SECTOR_SIZE, &sec, false);
+    if (!bio_unpin_sec ((const char *) di))
+      PANIC ("bio unpin");
+
+    off_t chunk;
+    if (n > 0) {
+      void *bufs[DIRECT_MAX];
+      for (int i = 0; i < n; ++i)
+        bufs[i] = buffer + i * BLOCK_SECTOR_SIZE;
+      bio_sync (sec, n);
+      block_read_multi (fs_device, sec, n, bufs);
+      lock_release (&inode->lk);
+      chunk = n * BLOCK_SECTOR_SIZE;
+    } else {
+      lock_release (&inode->lk);
+      chunk = inode_read_at (inode, buffer, BLOCK_SECTOR_SIZE, offset);
+      if (chunk == 0)
+        break;
+    }
+
+    /* Advance */
+    bytes_read += chunk;
+    size -= chunk;
+    buffer += chunk;
+    offset += chunk;
+  }
+  return bytes_read;
+}
+
+/** Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   moving whole blocks that are already on disk straight from BUFFER
+   to the disk. Cached copies of those sectors are updated. 
+   Unaligned requests, and blocks that are not allocated yet or lie
+   past end of file, go through inode_write_at.
+   Returns the number of bytes actually written. */
+off_t
+inode_write_direct (struct inode *inode, const void *buffer_, off_t size,
+                    off_t offset)
+{
+  if (sec_off (offset) != 0 || sec_off (size) != 0
+      || tmpfs_is (inode->sector))
+    return inode_write_at (inode, buffer_, size, offset);
+
+  const char *buffer = buffer_;
+  off_t bytes_wrt = 0;
+  while (size > 0) {
+    lock_acquire (&inode->lk);
+    if (inode->deny_write_cnt > 0) {
+      lock_release (&inode->lk);
+      break;
+    }
+    const struct inode_disk *di = (const struct inode_disk *) 
+                                  bio_read (inode->sector);
+    const off_t left = di->size - offset;
+    const off_t want = size < left ? size : left;
+    int sec, n = 0;
+    if (want >= BLOCK_SECTOR_SIZE)
+      n = inode_direct_run (inode, di, offset / BLOCK_SECTOR_SIZE,
+                            want / BLOCK_SECTOR_SIZE, &sec, true);
+    if (!bio_unpin_sec ((const char *) di))
+      PANIC ("bio unpin");
+
+    off_t chunk;
+    if (n > 0) {
+      void *bufs[DIRECT_MAX];
+      for (int i = 0; i < n; ++i)
+        bufs[i] = (char *) buffer + i * BLOCK_SECTOR_SIZE;
+      block_write_multi (fs_device, sec, n, bufs);
+      bio_refresh (sec, n, bufs);
+      lock_release (&inode->lk);
+      chunk = n * BLOCK_SECTOR_SIZE;
+    } else {
+      lock_release (&inode->lk);
+      chunk = inode_write_at (inode, buffer, BLOCK_SECTOR_SIZE, offset);
+      if (chunk == 0)
+        break;
+    }
+
+    /* Advance */
+    bytes_wrt += chunk;
+    size -= chunk;
+    buffer += chunk;
+    offset += chunk;
+  }
+  return bytes_wrt;
+}
+
+/** Grows INODE to LENGTH bytes without writing a block, so that the
+   new part is a hole. Like inode_write_at, refuses to go past MAXFILE
+   or to touch an inode that denies writes. Returns false if it could
+   not grow INODE, e.g. because the disk is full. */
+static bool
+inode_grow (struct inode *inode, off_t length)
+{
+  if (length <= inode_length (inode))
+    return true;
+  if (length > MAXFILE)
+    return false;
+  if (tmpfs_is (inode->sector))
+    return inode_write_at (inode, "", 1, length - 1) == 1;
+
+  bool success = true;
+  lock_acquire (&inode->lk);
+  if (inode->deny_write_cnt > 0) {
+    lock_release (&inode->lk);
+    return false;
+  }
+  struct inode_disk *di = (struct inode_disk *) bio_write (inode->sector);
+  if (length > di->size) {
+    if (inode_is_inline (di) && length > (off_t) INLINE_SIZE) {
+      success = inode_promote (di);
+      if (success)
+        inode_mark_block (inode, di, 0);
+    } else if (inode_is_inline (di)) {
+      memset (di->inline_data + di->size, 0, length - di->size);
+    }
+    if (success) {
+      di->size = length;
+      inode->meta_dirty = true;
+    }
+  }
+  if (!bio_unpin_sec (di))
+    PANIC ("bio unpin");
+  lock_release (&inode->lk);
+  return success;
+}
+
+/** Copies SIZE bytes of SRC starting at SRC_OFS into DST starting
+   at DST_OFS. Blocks of SRC that are on disk are copied out of their
+   cache line while SRC is locked, since defrag or unsharing may move
+   the sector as soon as the lock is released; inline data, holes and
+   delayed blocks are read with inode_read_at instead.
+   Holes of SRC that land past the end of DST are skipped, so DST
+   stays sparse where SRC is, and a trailing hole only grows DST.
+   Never holds the locks of both inodes at once, so SRC may be DST.
+   Returns the number of bytes copied, which is less than SIZE at
+   the end of SRC or if the disk is full. */
+off_t
+inode_copy_range (struct inode *src, off_t src_ofs, struct inode *dst,
+                  off_t dst_ofs, off_t size)
+{
+  char tmp[BLOCK_SECTOR_SIZE];
+  off_t copied = 0;
+  off_t skipped = 0;                    /**< Holes left out of DST since
+                                             the last write. */
+
+  /* A tmpfs source has no cache lines to pin, bounce everything. */
+  while (size > 0 && tmpfs_is (src->sector)) {
+    const off_t chunk = size < BLOCK_SECTOR_SIZE ? size : BLOCK_SECTOR_SIZE;
+    const off_t n = inode_read_at (src, tmp, chunk, src_ofs);
+    const off_t w = n > 0 ? inode_write_at (dst, tmp, n, dst_ofs) : 0;
+    copied += w;
+    if (w < chunk)
+      return copied;
+    size -= w;
+    src_ofs += w;
+    dst_ofs += w;
+  }
+
+  while (size > 0) {
+    const off_t sec_of = sec_off (src_ofs);
+    const int idx = src_ofs / BLOCK_SECTOR_SIZE;
+    off_t chunk = BLOCK_SECTOR_SIZE - sec_of;
+    chunk = chunk > size ? size : chunk;
+    bool cached = false;
+    off_t hole = 0;
+
+    /* Find the source sector and copy it out under the lock. */
+    lock_acquire (&src->lk);
+    const struct inode_disk *di = (const struct inode_disk *) 
+                                  bio_read (src->sector);
+    if (di->size - src_ofs < chunk)
+      chunk = di->size - src_ofs;
+    if (chunk > 0 && !inode_is_inline (di) 
+        && inode_delayed_find (src, idx) == NULL) {
+      const int sec = inode_lookup_sec (di, idx);
+      if (sec != INODE_INVALID) {
+        const char *line = bio_read (sec);
+        memcpy (tmp, line + sec_of, chunk);
+        if (!bio_unpin_sec (line))
+          PANIC ("bio unpin");
+        cached = true;
+      } else {
+        /* Length of the hole, up to the next delayed block. */
+        int end = inode_hole_end (di, idx);
+        struct delayed_block *db = inode_delayed_next (src, idx);
+        if (db != NULL && db->idx < end)
+          end = db->idx;
+        hole = (off_t) end * BLOCK_SECTOR_SIZE - src_ofs;
+        hole = hole > size ? size : hole;
+        hole = hole > di->size - src_ofs ? di->size - src_ofs : hole;
+      }
+    }
+    if (!bio_unpin_sec ((const char *) di))
+      PANIC ("bio unpin");
+    lock_release (&src->lk);
+    if (chunk <= 0)
+      break;
+
+    /* Past the end of DST a hole reads as zeros anyway. */
+    if (hole > 0 && dst_ofs >= inode_length (dst)) {
+      skipped += hole;
+      copied += hole;
+      size -= hole;
+      src_ofs += hole;
+      dst_ofs += hole;
+      continue;
+    }
+
+    if (!cached && inode_read_at (src, tmp, chunk, src_ofs) != chunk)
+      break;
+
+    const off_t n = inode_write_at (dst, tmp, chunk, dst_ofs);
+
+    /* Advance. A write past the holes has grown DST over them. */
+    copied += n;
+    if (n > 0)
+      skipped = 0;
+    if (n < chunk)
+      break;
+    size -= n;
+    src_ofs += n;
+    dst_ofs += n;
+  }
+
+  /* Holes not followed by a write still have to grow DST; if it
+     cannot grow, they were not copied. */
+  if (skipped > 0 && !inode_grow (dst, dst_ofs))
+    copied -= skipped;
+  return copied;
+}
+
+/** Makes the inode at SECTOR a copy of SRC that shares all of its
+   data blocks: each data sector gains an owner in the refcount file
+   instead of being copied, and inode_write_at gives either inode a
+   private copy of a block once it is written. The clone only gets
+   indirect blocks of its own.
+   Returns true if successful. On failure, SECTOR and everything 
+   the clone got hold of are released. */
+bool
+inode_clone (struct inode *src, block_sector_t sector)
+{
+  bool success = true;
+  ASSERT (!tmpfs_is (src->sector) && !tmpfs_is (sector));
+
+  /* Every block must be on disk to be shared. */
+  lock_acquire (&src->lk);
+  inode_flush_delayed (src);
+  const struct inode_disk *from = (const struct inode_disk *) 
+                                  bio_read (src->sector);
+  struct inode_disk *di = (struct inode_disk *) bio_overwrite (sector);
+  memcpy (di, from, BLOCK_SECTOR_SIZE);
+  di->nlink = 1;
+
+  if (!inode_is_inline (from)) {
+    for (int i = 0; i < 125; ++i)
+      {
+        di->addrs[i] = INODE_INVALID;
+      }
+
+    const int last = DIV_ROUND_UP (from->size, BLOCK_SECTOR_SIZE);
+    for (int idx = inode_hole_end (from, 0); idx < last; 
+         idx = inode_hole_end (from, idx + 1))
+      {
+        const int sec = inode_lookup_sec (from, idx);
+        block_sector_t dsec = sec;
+        if (!refcnt_inc (sec)) {
+          /* Too many owners to count, copy this block. */
+          if (!free_map_allocate (1U, &dsec)) {
+            success = false;
+            break;
+          }
+          const char *dat = bio_read (sec);
+          char *cpy = bio_overwrite (dsec);
+          memcpy (cpy, dat, BLOCK_SECTOR_SIZE);
+          if (!bio_unpin_sec (cpy) || !bio_unpin_sec (dat))
+            PANIC ("bio unpin");
+        }
+        if (!inode_set_sec (di, idx, dsec)) {
+          if (!refcnt_dec (dsec))
+            free_map_release (dsec, 1U);
+          success = false;
+          break;
+        }
+      }
+  }
+
+  if (!bio_unpin_sec ((const char *) di) 
+      || !bio_unpin_sec ((const char *) from))
+    PANIC ("bio unpin");
+  lock_release (&src->lk);
+
+  if (!success)
+    inode_deallocate (sector, NULL);
+  return success;
+}
+
 /** Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -1155,6 +2315,8 @@ inode_length (const struct inode *inode)
   off_t ret = 0;
   if (inode->removed)
     return ret;
+  if (tmpfs_is (inode->sector))
+    return tmpfs_length (inode->sector);
 
   /* Create critical section */
   lock_acquire (&inode->lk);
@@ -1172,6 +2334,224 @@ length_done:
   return ret;
 }
 
+/** Returns the offset of the first byte at or after OFFSET in INODE
+   that is data, or that lies in a hole if HOLE is set. The end of
+   file counts as a hole. Returns -1 if OFFSET is at or past the end
+   of file, or if HOLE is not set and there is no data after it. */
+off_t
+inode_seek_data (struct inode *inode, off_t offset, bool hole)
+{
+  if (tmpfs_is (inode->sector)) {
+    /* No hole tracking, all of it is data. */
+    const off_t size = inode_length (inode);
+    if (offset < 0 || offset >= size)
+      return -1;
+    return hole ? size : offset;
+  }
+
+  const struct inode_disk *di = (const struct inode_disk *) 
+                                bio_read (inode->sector);
+  lock_acquire (&inode->lk);
+
+  off_t ret = -1;
+  if (offset < 0 || offset >= di->size)
+    goto done;
+  if (inode_is_inline (di)) {
+    /* All data, no holes. */
+    ret = hole ? di->size : offset;
+    goto done;
+  }
+
+  const int last = DIV_ROUND_UP (di->size, BLOCK_SECTOR_SIZE);
+  int idx = offset / BLOCK_SECTOR_SIZE;
+  while (idx < last) 
+    {
+      /* Delayed blocks are data, though they are not mapped yet. */
+      struct delayed_block *db = inode_delayed_next (inode, idx);
+      int next = inode_hole_end (di, idx);
+      if (db != NULL && db->idx < next)
+        next = db->idx;
+
+      if (hole && next > idx)
+        break;
+      if (!hole && next == idx)
+        break;
+      idx = hole ? idx + 1 : next;
+    }
+
+  if (idx < last)
+    ret = (off_t) idx * BLOCK_SECTOR_SIZE > offset 
+        ? (off_t) idx * BLOCK_SECTOR_SIZE : offset;
+  else if (hole)
+    ret = di->size;
+
+done:
+  lock_release (&inode->lk);
+  if (!bio_unpin_sec ((const char *) di))
+    PANIC ("bio unpin");
+  return ret;
+}
+
+/** Writes the data of INODE that is still in the buffer cache back
+   to disk: delayed blocks, written data sectors and, unless DATASYNC
+   is set and neither the size nor the block map changed, the inode
+   sector and its indirect blocks. The refcount file and the free
+   map follow, since the blocks are only safe once those record them
+   as shared or in use. */
+void
+inode_sync (struct inode *inode, bool datasync)
+{
+  if (tmpfs_is (inode->sector))
+    return;
+
+  lock_acquire (&inode->lk);
+  inode_flush_delayed (inode);
+
+  const struct inode_disk *di = (const struct inode_disk *) 
+                                bio_read (inode->sector);
+  if (inode->dirty_cnt < 0) {
+    /* Lost track, write the whole file. */
+    inode_sync_map (di, true);
+  } else {
+    for (int i = 0; i < inode->dirty_cnt; ++i)
+      bio_sync (inode->dirty[i], 1);
+    if (inode->meta_dirty || !datasync)
+      inode_sync_map (di, false);
+  }
+  if (!bio_unpin_sec ((const char *) di))
+    PANIC ("bio unpin");
+  if (inode->meta_dirty || !datasync || inode_is_inline (di))
+    bio_sync (inode->sector, 1);
+
+  inode->dirty_cnt = 0;
+  inode->meta_dirty = false;
+  lock_release (&inode->lk);
+
+  /* The refcount file comes here itself, its blocks are in the free
+     map written by the outer call. */
+  if (inode->sector != REFCNT_SECTOR) {
+    refcnt_sync ();
+    free_map_sync ();
+  }
+}
+
+/**< Most blocks inode_defrag moves into one run. */
+#define DEFRAG_RUN 64
+
+/** Stores into secs the sectors of the blocks of di from idx on
+   that are on disk and not shared with a clone, up to min(cnt,
+   DEFRAG_RUN) of them.
+   @return number of such blocks. */
+static int
+inode_defrag_scan (const struct inode_disk *di, int idx, int cnt,
+                   block_sector_t *secs)
+{
+  int n;
+  for (n = 0; n < cnt && n < DEFRAG_RUN; ++n) {
+    const int s = inode_lookup_sec (di, idx + n);
+    if (s == INODE_INVALID || refcnt_shared (s))
+      break;
+    secs[n] = s;
+  }
+  return n;
+}
+
+/** Moves the cnt blocks of ino from idx on, stored in secs, into
+   fresh consecutive sectors, fewer if the free map has no run that
+   long. Indirect blocks already exist, so the block map is updated
+   in place.
+   @return number of blocks moved, 0 if none could be. */
+static int
+inode_defrag_run (struct inode *ino, struct inode_disk *di, int idx,
+                  int cnt, block_sector_t *secs)
+{
+  /* Moving a single block gains nothing. */
+  block_sector_t start;
+  while (cnt > 1 && !free_map_allocate (cnt, &start))
+    cnt /= 2;
+  if (cnt <= 1)
+    return 0;
+
+  for (int i = 0; i < cnt; ++i)
+    {
+      const char *from = bio_read (secs[i]);
+      char *to = bio_overwrite (start + i);
+      memcpy (to, from, BLOCK_SECTOR_SIZE);
+      if (!bio_unpin_sec (to) || !bio_unpin_sec (from))
+        PANIC ("bio unpin");
+      if (!inode_set_sec (di, idx + i, start + i))
+        PANIC ("defrag remap");
+      inode_mark_sec (ino, start + i);
+    }
+  free_map_release_batch (secs, cnt);
+  ino->meta_dirty = true;
+  return cnt;
+}
+
+/** Relocates the data blocks of INODE so that they sit in runs of
+   consecutive sectors, which multi-sector and direct I/O can move at
+   once. The inode stays usable meanwhile: every block is copied and
+   remapped while holding its lock. Holes stay holes, and blocks
+   shared with a clone are left in place.
+   Returns the number of blocks moved. */
+int
+inode_defrag (struct inode *inode)
+{
+  /* System files hold fixed sectors or are read under other locks. */
+  if (tmpfs_is (inode->sector) || inode->sector == FREE_MAP_SECTOR
+      || inode->sector == REFCNT_SECTOR)
+    return 0;
+
+  lock_acquire (&inode->lk);
+  inode_flush_delayed (inode);
+
+  int moved = 0;
+  struct inode_disk *di = (struct inode_disk *) bio_write (inode->sector);
+  if (!inode_is_inline (di)) {
+    const int nblk = DIV_ROUND_UP (di->size, BLOCK_SECTOR_SIZE);
+    block_sector_t secs[DEFRAG_RUN];
+    int idx = 0;
+    while (idx < nblk)
+      {
+        const int n = inode_defrag_scan (di, idx, nblk - idx, secs);
+        if (n == 0) {
+          ++idx;
+          continue;
+        }
+
+        /* Leave runs that are already in order. */
+        int i;
+        for (i = 1; i < n && secs[i] == secs[0] + i; ++i)
+          continue;
+        const int m = i < n ? inode_defrag_run (inode, di, idx, n, secs)
+                            : 0;
+        moved += m;
+        idx += m > 0 ? m : n;
+      }
+  }
+  if (!bio_unpin_sec ((const char *) di))
+    PANIC ("bio unpin");
+  lock_release (&inode->lk);
+  return moved;
+}
+
+/** Write back delayed blocks of all open inodes. */
+void
+inode_flush_all (void)
+{
+  struct list_elem *e;
+  lock_acquire (&inode_list_lock);
+  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
+       e = list_next (e))
+    {
+      struct inode *ino = list_entry (e, struct inode, elem);
+      lock_acquire (&ino->lk);
+      inode_flush_delayed (ino);
+      lock_release (&ino->lk);
+    }
+  lock_release (&inode_list_lock);
+}
+
 /** Returns the type of an inode. */
 int 
 inode_typ (const struct inode *ino)
@@ -1179,6 +2559,8 @@ inode_typ (const struct inode *ino)
   ASSERT (ino->sector != INODE_INVALID);
   if (ino->removed)
     return INODE_NULL;
+  if (tmpfs_is (ino->sector))
+    return tmpfs_type (ino->sector);
   const struct inode_disk *di = bio_read (ino->sector);
   if (di->magic != INODE_MAGIC) {
     /* Not an inode, probably a removed inode. */
@@ -1193,6 +2575,8 @@ inode_typ (const struct inode *ino)
 int 
 inode_is_file (const struct inode *ino)
 {
+  if (tmpfs_is (ino->sector))
+    return tmpfs_type (ino->sector) == INODE_FILE;
   const struct inode_disk *di = bio_read (ino->sector);
   int ret = di->type == INODE_FILE && di->magic == INODE_MAGIC;
   bio_unpin_sec (di);
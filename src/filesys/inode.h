@@ -2,6 +2,7 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
@@ -19,6 +20,8 @@ enum inode_type {
 
 void inode_init (void);
 bool inode_create (block_sector_t, off_t, int);
+bool inode_create_extent (block_sector_t, block_sector_t start, size_t cnt,
+                          int);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
@@ -26,11 +29,22 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_read_direct (struct inode *, void *, off_t size, off_t offset);
+off_t inode_write_direct (struct inode *, const void *, off_t size, 
+                          off_t offset);
+off_t inode_copy_range (struct inode *src, off_t src_ofs, struct inode *dst,
+                        off_t dst_ofs, off_t size);
+bool inode_clone (struct inode *src, block_sector_t sector);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
 int inode_typ (const struct inode *);
 int inode_num (const struct inode *);
 int inode_is_file (const struct inode *);
+void inode_sync (struct inode *, bool datasync);
+int inode_defrag (struct inode *);
+off_t inode_seek_data (struct inode *, off_t offset, bool hole);
+void inode_flush_all (void);
+void inode_reap_wait (void);
 
 #endif /**< filesys/inode.h */
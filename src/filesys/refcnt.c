@@ -0,0 +1,112 @@
+#include "filesys/refcnt.h"
+#include <debug.h>
+#include <stdint.h>
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/synch.h"
+
+/** Reference counts of data sectors shared by cloned files. The
+   refcount file holds one byte per sector of the file system: the
+   number of owners besides the first. It is written only by clones,
+   so it stays a sparse file whose holes read as "not shared". */
+
+static struct file *refcnt_file;     /**< Refcount file. */
+static struct lock refcnt_lock;      /**< Makes updates atomic. */
+static bool refcnt_any;              /**< Any sector ever shared? */
+
+/** Most owners besides the first that a sector can have. */
+#define REFCNT_MAX UINT8_MAX
+
+/** Returns the extra owners of sector. */
+static uint8_t
+refcnt_get (block_sector_t sector)
+{
+  uint8_t cnt = 0;
+  if (refcnt_any)
+    file_read_at (refcnt_file, &cnt, 1, sector);
+  return cnt;
+}
+
+/** Sets the extra owners of sector to cnt. */
+static bool
+refcnt_set (block_sector_t sector, uint8_t cnt)
+{
+  if (file_write_at (refcnt_file, &cnt, 1, sector) != 1)
+    return false;
+  refcnt_any = true;
+  return true;
+}
+
+/** Returns true if sector is owned by more than one file. */
+bool
+refcnt_shared (block_sector_t sector)
+{
+  if (!refcnt_any)
+    return false;
+  lock_acquire (&refcnt_lock);
+  bool shared = refcnt_get (sector) > 0;
+  lock_release (&refcnt_lock);
+  return shared;
+}
+
+/** Adds an owner to sector. Returns false if sector has as many
+   owners as can be counted, or the count cannot be written. */
+bool
+refcnt_inc (block_sector_t sector)
+{
+  lock_acquire (&refcnt_lock);
+  uint8_t cnt = refcnt_get (sector);
+  bool success = cnt < REFCNT_MAX && refcnt_set (sector, cnt + 1);
+  lock_release (&refcnt_lock);
+  return success;
+}
+
+/** Drops an owner of sector. Returns true if other owners remain,
+   false if the caller was the last one and must free sector. */
+bool
+refcnt_dec (block_sector_t sector)
+{
+  if (!refcnt_any)
+    return false;
+  lock_acquire (&refcnt_lock);
+  uint8_t cnt = refcnt_get (sector);
+  if (cnt > 0)
+    refcnt_set (sector, cnt - 1);
+  lock_release (&refcnt_lock);
+  return cnt > 0;
+}
+
+/** Writes the refcount file to disk. */
+void
+refcnt_sync (void)
+{
+  if (refcnt_any)
+    inode_sync (file_get_inode (refcnt_file), false);
+}
+
+/** Opens the refcount file. */
+void
+refcnt_open (void)
+{
+  lock_init (&refcnt_lock);
+  refcnt_file = file_open (inode_open (REFCNT_SECTOR));
+  if (refcnt_file == NULL)
+    PANIC ("can't open refcount file");
+  refcnt_any = file_length (refcnt_file) > 0;
+}
+
+/** Closes the refcount file. */
+void
+refcnt_close (void)
+{
+  file_close (refcnt_file);
+}
+
+/** Creates an empty refcount file on disk. */
+void
+refcnt_create (void)
+{
+  if (!inode_create (REFCNT_SECTOR, 0, INODE_FILE))
+    PANIC ("refcount file creation failed");
+}
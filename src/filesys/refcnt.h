@@ -0,0 +1,16 @@
+#ifndef FILESYS_REFCNT_H
+#define FILESYS_REFCNT_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+void refcnt_create (void);
+void refcnt_open (void);
+void refcnt_close (void);
+void refcnt_sync (void);
+
+bool refcnt_shared (block_sector_t);
+bool refcnt_inc (block_sector_t);
+bool refcnt_dec (block_sector_t);
+
+#endif /**< filesys/refcnt.h */
@@ -0,0 +1,214 @@
+#include "filesys/tmpfs.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/** Memory-only file system. Each inode keeps its data in kernel
+   pages that are allocated on first write; a page never written
+   reads as zeros. Directories are ordinary tmpfs inodes holding
+   directory entries, so directory.c works on them unchanged.
+   Callers serialize access to one inode with its inode lock. */
+
+/**< Most pages of one tmpfs inode. */
+#define TMPFS_PAGES (TMPFS_MAXFILE / PGSIZE)
+
+/**< tmpfs may hold one page in this many of the kernel pool, so that
+   filling it does not starve threads, page tables and the cache. */
+#define TMPFS_SHARE 4
+
+/** A tmpfs inode. */
+struct tmpfs_node
+  {
+    int type;                           /**< INODE_FILE or INODE_DIR */
+    off_t size;                         /**< Size of file (bytes) */
+    void *pages[TMPFS_PAGES];           /**< Data pages, NULL if unused */
+  };
+
+static struct tmpfs_node *tmpfs_nodes[TMPFS_NODES]; /**< By number */
+static struct lock tmpfs_lock;          /**< Protects tmpfs_nodes and
+                                             the page counts */
+static size_t tmpfs_page_max;           /**< Most data pages of tmpfs */
+static size_t tmpfs_page_cnt;           /**< Data pages held by tmpfs */
+
+/** Returns the node of inode number sec. */
+static struct tmpfs_node *
+tmpfs_node (block_sector_t sec)
+{
+  ASSERT (tmpfs_is (sec));
+  struct tmpfs_node *n = tmpfs_nodes[sec - TMPFS_BASE];
+  ASSERT (n != NULL);
+  return n;
+}
+
+/** Initializes tmpfs. */
+void
+tmpfs_init (void)
+{
+  lock_init (&tmpfs_lock);
+  tmpfs_page_max = palloc_kernel_cnt () / TMPFS_SHARE;
+}
+
+/** Returns a zeroed data page, NULL if tmpfs used up its share of
+   the kernel pool or the pool is empty. */
+static void *
+tmpfs_page_get (void)
+{
+  void *page = NULL;
+  lock_acquire (&tmpfs_lock);
+  if (tmpfs_page_cnt < tmpfs_page_max
+      && (page = palloc_get_page (PAL_ZERO)) != NULL)
+    tmpfs_page_cnt++;
+  lock_release (&tmpfs_lock);
+  return page;
+}
+
+/** Gives back a data page from tmpfs_page_get. */
+static void
+tmpfs_page_put (void *page)
+{
+  palloc_free_page (page);
+  lock_acquire (&tmpfs_lock);
+  tmpfs_page_cnt--;
+  lock_release (&tmpfs_lock);
+}
+
+/** Reserves an inode number and stores it into *SECP.
+   Returns false if there is no memory or no free number. */
+bool
+tmpfs_alloc (block_sector_t *secp)
+{
+  struct tmpfs_node *n = calloc (1, sizeof *n);
+  if (n == NULL)
+    return false;
+  n->type = INODE_NULL;
+
+  lock_acquire (&tmpfs_lock);
+  for (int i = 0; i < TMPFS_NODES; ++i)
+    {
+      if (tmpfs_nodes[i] == NULL) {
+        tmpfs_nodes[i] = n;
+        lock_release (&tmpfs_lock);
+        *secp = TMPFS_BASE + i;
+        return true;
+      }
+    }
+  lock_release (&tmpfs_lock);
+  free (n);
+  return false;
+}
+
+/** Turns the reserved inode number sec into an inode of the given
+   type and size. Always succeeds, pages come with the first write. */
+bool
+tmpfs_create (block_sector_t sec, off_t size, int type)
+{
+  struct tmpfs_node *n = tmpfs_node (sec);
+  if (size > TMPFS_MAXFILE)
+    return false;
+  n->type = type;
+  n->size = size;
+  return true;
+}
+
+/** Frees the pages of inode number sec and the number itself. */
+void
+tmpfs_release (block_sector_t sec)
+{
+  struct tmpfs_node *n = tmpfs_node (sec);
+  for (int i = 0; i < TMPFS_PAGES; ++i)
+    {
+      if (n->pages[i] != NULL)
+        tmpfs_page_put (n->pages[i]);
+    }
+
+  lock_acquire (&tmpfs_lock);
+  tmpfs_nodes[sec - TMPFS_BASE] = NULL;
+  lock_release (&tmpfs_lock);
+  free (n);
+}
+
+/** Reads up to SIZE bytes at OFFSET of inode number sec into BUFFER.
+   Returns the number of bytes read, short at end of file. */
+off_t
+tmpfs_read (block_sector_t sec, void *buffer_, off_t size, off_t offset)
+{
+  struct tmpfs_node *n = tmpfs_node (sec);
+  char *buffer = buffer_;
+  off_t bytes_read = 0;
+
+  ASSERT (n->size <= TMPFS_MAXFILE);
+  if (offset < 0 || offset >= n->size)
+    return 0;
+  if (size > n->size - offset)
+    size = n->size - offset;
+
+  while (size > 0) {
+    const void *page = n->pages[offset / PGSIZE];
+    off_t chunk = PGSIZE - offset % PGSIZE;
+    chunk = chunk > size ? size : chunk;
+    if (page == NULL)
+      memset (buffer, 0, chunk);
+    else
+      memcpy (buffer, page + offset % PGSIZE, chunk);
+
+    /* Advance */
+    bytes_read += chunk;
+    size -= chunk;
+    buffer += chunk;
+    offset += chunk;
+  }
+  return bytes_read;
+}
+
+/** Writes SIZE bytes from BUFFER at OFFSET of inode number sec,
+   growing it as needed. Returns the number of bytes written, short
+   if the file would outgrow TMPFS_MAXFILE or tmpfs its share of
+   memory. */
+off_t
+tmpfs_write (block_sector_t sec, const void *buffer_, off_t size, 
+             off_t offset)
+{
+  struct tmpfs_node *n = tmpfs_node (sec);
+  const char *buffer = buffer_;
+  off_t bytes_wrt = 0;
+
+  if (offset < 0)
+    return 0;
+  while (size > 0 && offset < TMPFS_MAXFILE) {
+    void **page = &n->pages[offset / PGSIZE];
+    if (*page == NULL && (*page = tmpfs_page_get ()) == NULL)
+      break;
+    off_t chunk = PGSIZE - offset % PGSIZE;
+    chunk = chunk > size ? size : chunk;
+    memcpy (*page + offset % PGSIZE, buffer, chunk);
+
+    /* Advance */
+    bytes_wrt += chunk;
+    size -= chunk;
+    buffer += chunk;
+    offset += chunk;
+  }
+
+  /* Update the size of file, only as far as was written. */
+  if (bytes_wrt > 0 && offset > n->size)
+    n->size = offset;
+  return bytes_wrt;
+}
+
+/** Returns the size of inode number sec in bytes. */
+off_t
+tmpfs_length (block_sector_t sec)
+{
+  return tmpfs_node (sec)->size;
+}
+
+/** Returns the type of inode number sec. */
+int
+tmpfs_type (block_sector_t sec)
+{
+  return tmpfs_node (sec)->type;
+}
@@ -0,0 +1,35 @@
+#ifndef FILESYS_TMPFS_H
+#define FILESYS_TMPFS_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/** Inode numbers from TMPFS_BASE on name tmpfs inodes, which live
+   in memory only. Disk sectors never get this far. */
+#define TMPFS_BASE 0x40000000
+
+/**< Most tmpfs inodes at once. */
+#define TMPFS_NODES 256
+
+/**< Largest tmpfs file, in bytes. */
+#define TMPFS_MAXFILE (1024 * 1024)
+
+/** Returns true if inode number sec belongs to tmpfs. */
+static inline bool
+tmpfs_is (block_sector_t sec)
+{
+  return sec >= TMPFS_BASE && sec < TMPFS_BASE + TMPFS_NODES;
+}
+
+void tmpfs_init (void);
+bool tmpfs_alloc (block_sector_t *);
+bool tmpfs_create (block_sector_t, off_t size, int type);
+void tmpfs_release (block_sector_t);
+
+off_t tmpfs_read (block_sector_t, void *, off_t size, off_t offset);
+off_t tmpfs_write (block_sector_t, const void *, off_t size, off_t offset);
+off_t tmpfs_length (block_sector_t);
+int tmpfs_type (block_sector_t);
+
+#endif /**< filesys/tmpfs.h */
@@ -0,0 +1,26 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <stddef.h>
+
+/** Directory entry as returned by getdents().
+   Entries are packed back to back in the caller's buffer, each 
+   d_reclen bytes long (a multiple of 4). */
+struct dirent
+  {
+    int d_ino;                  /**< Inode number. */
+    unsigned short d_reclen;    /**< Length of this record. */
+    unsigned char d_type;       /**< DT_REG or DT_DIR. */
+    unsigned char d_namlen;     /**< Length of d_name, not counting null. */
+    char d_name[];              /**< Null terminated file name. */
+  };
+
+/** Values of d_type. */
+#define DT_REG 1                /**< Regular file. */
+#define DT_DIR 2                /**< Directory. */
+
+/** Size of a record holding a name NAMLEN characters long. */
+#define DIRENT_RECLEN(NAMLEN) \
+  ((offsetof (struct dirent, d_name) + (NAMLEN) + 1 + 3) & ~3u)
+
+#endif /**< lib/dirent.h */
@@ -15,6 +15,13 @@
 #define STDIN_FILENO 0
 #define STDOUT_FILENO 1
 
+/** Whence values for lseek(). */
+#define SEEK_SET 0              /**< Offset from start of file. */
+#define SEEK_CUR 1              /**< Offset from current position. */
+#define SEEK_END 2              /**< Offset from end of file. */
+#define SEEK_DATA 3             /**< Next data at or after offset. */
+#define SEEK_HOLE 4             /**< Next hole at or after offset. */
+
 /** Standard functions. */
 int printf (const char *, ...) PRINTF_FORMAT (1, 2);
 int snprintf (char *, size_t, const char *, ...) PRINTF_FORMAT (3, 4);
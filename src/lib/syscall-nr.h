@@ -28,7 +28,19 @@ enum
     SYS_MKDIR,                  /**< Create a directory. */
     SYS_READDIR,                /**< Reads a directory entry. */
     SYS_ISDIR,                  /**< Tests if a fd represents a directory. */
-    SYS_INUMBER                 /**< Returns the inode number for a fd. */
+    SYS_INUMBER,                /**< Returns the inode number for a fd. */
+    SYS_GETDENTS,               /**< Reads many directory entries. */
+    SYS_PREAD,                  /**< Read from a file at an offset. */
+    SYS_PWRITE,                 /**< Write to a file at an offset. */
+    SYS_READV,                  /**< Read into several buffers. */
+    SYS_WRITEV,                 /**< Write from several buffers. */
+    SYS_COPY_FILE_RANGE,        /**< Copy between two files in kernel. */
+    SYS_DIRECTIO,               /**< Bypass the buffer cache for a fd. */
+    SYS_FSYNC,                  /**< Write a file's data and inode to disk. */
+    SYS_FDATASYNC,              /**< Write a file's data to disk. */
+    SYS_LSEEK,                  /**< Seek relative, or to data or hole. */
+    SYS_REFLINK,                /**< Create a file sharing another's data. */
+    SYS_DEFRAG                  /**< Move a file's blocks into runs. */
   };
 
 #endif /**< lib/syscall-nr.h */
@@ -0,0 +1,14 @@
+#ifndef __LIB_UIO_H
+#define __LIB_UIO_H
+
+/** One buffer of a readv() or writev() call. */
+struct iovec
+  {
+    void *iov_base;             /**< Start of the buffer. */
+    unsigned iov_len;           /**< Length of the buffer in bytes. */
+  };
+
+/** Maximum number of buffers in one readv() or writev() call. */
+#define IOV_MAX 32
+
+#endif /**< lib/uio.h */
@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <dirent.h>
+#include <uio.h>
 
 /** Process identifier. */
 typedef int pid_t;
@@ -44,5 +46,17 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+int getdents (int fd, void *buffer, unsigned size);
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int copy_file_range (int fd_in, int fd_out, unsigned length);
+bool directio (int fd, bool enable);
+bool fsync (int fd);
+bool fdatasync (int fd);
+int lseek (int fd, int offset, int whence);
+bool reflink (int fd, const char *file);
+int defrag (int fd);
 
 #endif /**< lib/user/syscall.h */
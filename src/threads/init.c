@@ -49,6 +49,9 @@ static bool format_filesys;
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
+
+/** -tmpfs: Directory to serve from a memory-only file system. */
+static const char *tmpfs_dir_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
@@ -125,6 +128,8 @@ pintos_init (void)
   ide_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
+  if (tmpfs_dir_name != NULL && !fs_mount_tmpfs (tmpfs_dir_name))
+    printf ("cannot mount tmpfs on %s\n", tmpfs_dir_name);
 #endif
 
   printf ("Boot complete.\n");
@@ -287,9 +292,16 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-tmpfs"))
+        tmpfs_dir_name = value;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-evict"))
+        {
+          if (!frametb_set_policy (value))
+            PANIC ("unknown eviction policy `%s' (use -h for help)", value);
+        }
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
@@ -355,6 +367,7 @@ run_actions (char **argv)
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
       {"rm", 2, fsutil_rm},
+      {"defrag", 2, fsutil_defrag},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
 #endif
@@ -403,6 +416,7 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  defrag FILE        Move FILE's blocks into contiguous runs.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -415,8 +429,11 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -tmpfs=DIR         Keep files under DIR in memory only.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -evict=POLICY      Evict pages by POLICY: eclock (default),\n"
+          "                     clock or random.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
@@ -148,6 +148,29 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/** Returns the number of pages in the kernel pool. */
+size_t
+palloc_kernel_cnt (void)
+{
+  return bitmap_size (kernel_pool.used_map);
+}
+
+/** Returns the number of pages in the user pool. */
+size_t
+palloc_user_cnt (void)
+{
+  return bitmap_size (user_pool.used_map);
+}
+
+/** Returns the index of PAGE, which must come from the user pool,
+   among the pages of the user pool. */
+size_t
+palloc_user_idx (const void *page)
+{
+  ASSERT (page_from_pool (&user_pool, (void *) page));
+  return pg_no (page) - pg_no (user_pool.base);
+}
+
 /** Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
@@ -16,5 +16,8 @@ void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+size_t palloc_kernel_cnt (void);
+size_t palloc_user_cnt (void);
+size_t palloc_user_idx (const void *);
 
 #endif /**< threads/palloc.h */
@@ -147,10 +147,8 @@ process_handle_pgfault (void *uaddr, void *esp)
     return 0;
   
   /* Install the stack. */
-  void *page = vm_alloc_page (0, uaddr);
-  struct thread *cur = thread_current ();
-  pagedir_set_page (cur->pagedir, pg_round_down (uaddr), page, true);
-  return page != NULL;
+  void *page = vm_alloc_page (1, uaddr);
+  return vm_install_page (pg_round_down (uaddr), page, true);
 }
 #endif
 
@@ -213,15 +211,17 @@ page_fault (struct intr_frame *f)
       /** install page on stack */
 #ifndef VM
       void *page = palloc_get_page (PAL_USER);
-#else
-      void *page = vm_alloc_page (0, pg_round_down (fault_addr));
-#endif
       if (page == NULL) 
         goto kill_user;
       
       struct thread *cur = thread_current ();
       pagedir_set_page (cur->pagedir, pg_round_down (fault_addr),
                         page, true);
+#else
+      void *page = vm_alloc_page (1, pg_round_down (fault_addr));
+      if (!vm_install_page (pg_round_down (fault_addr), page, true))
+        goto kill_user;
+#endif
 
       /** Successfully installed stack. */
       return;
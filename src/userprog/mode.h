@@ -29,10 +29,4 @@
 
 #undef TEST
 
-/**< Number of frames for each process */
-#define NFRAME 16
-
-/** At most map 8 files for a single process */
-#define NMMAP 8
-
 #endif /**< userprog/mode.h */
@@ -6,8 +6,13 @@
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
+/** Beyond this many pages, reloading CR3 is cheaper than invlpg on
+   each of them. */
+#define INVLPG_MAX 32
+
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *);
 
 /** Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -169,8 +174,39 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
+      invalidate_page (pd, upage);
+    }
+}
+
+/** Like pagedir_clear_page, but leaves the TLB alone, so that
+   clearing many pages costs one invalidation.  The caller must call
+   pagedir_invalidate on UPAGE before its frame is used again. */
+void
+pagedir_clear_page_lazy (uint32_t *pd, void *upage) 
+{
+  uint32_t *pte;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  pte = lookup_page (pd, upage, false);
+  if (pte != NULL)
+    *pte &= ~PTE_P;
+}
+
+/** Invalidates the TLB entries of CNT pages from UPAGE in PD, after
+   changes made with pagedir_clear_page_lazy.  A CNT of SIZE_MAX
+   stands for all of user space. */
+void
+pagedir_invalidate (uint32_t *pd, const void *upage, size_t cnt) 
+{
+  if (cnt > INVLPG_MAX)
+    {
       invalidate_pagedir (pd);
+      return;
     }
+  for (size_t i = 0; i < cnt; i++)
+    invalidate_page (pd, (const uint8_t *) upage + i * PGSIZE);
 }
 
 /** Returns true if the PTE for virtual page VPAGE in PD is dirty,
@@ -197,7 +233,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -226,7 +262,7 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -278,3 +314,13 @@ invalidate_pagedir (uint32_t *pd)
       pagedir_activate (pd);
     } 
 }
+
+/** Invalidates the TLB entry of the single page VADDR if PD is the
+   active page directory, leaving the rest of the TLB warm.  See
+   [IA32-v2a] "INVLPG--Invalidate TLB Entry". */
+static void
+invalidate_page (uint32_t *pd, const void *vaddr) 
+{
+  if (active_pd () == pd) 
+    asm volatile ("invlpg (%0)" : : "r" (vaddr) : "memory");
+}
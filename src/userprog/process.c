@@ -1,5 +1,6 @@
 #include "userprog/process.h"
 #include <debug.h>
+#include <dirent.h>
 #include <list.h>
 #include <inttypes.h>
 #include <round.h>
@@ -232,10 +233,8 @@ process_exit (void)
 #else
   /* Implicitly unmap all files. */
 #ifdef VM
-  for (int i = 0; i < NMMAP; ++i) {
-    if (m->mmaptb[i] != NULL)
-      vm_unmap (i);
-  }
+  if (m != NULL && m->map_file_tb != NULL)
+    vm_unmap_all ();
 #endif
   for (int i = 0; i < MAX_FILE; ++i) {
     if (m != NULL)
@@ -255,16 +254,17 @@ process_exit (void)
   if (m == NULL)
     goto unblock_op;
 #ifdef VM
-   /* Free the members of process_meta */
-   if (m->map_file_rt != NULL)
-     map_file_clear (m->map_file_rt);
+  /* Free the frames first, other processes may evict them until then
+     and need the tables below to do so. */
+  vm_exit ();
 
-  /* Free the swap table. */
-  if (m->swaptb != NULL)
-    swaptb_free (m->swaptb);
+   /* Free the members of process_meta */
+   if (m->map_file_tb != NULL)
+     map_file_clear (m->map_file_tb);
 
-  /* Free the frame table. */
-  frametb_free (&m->frametb);
+  /* Free the swap slots, held in the pagedir. */
+  if (cur->pagedir != NULL)
+    swaptb_free (cur->pagedir);
 #endif
   if (m != NULL)
   free (*mpp);
@@ -451,17 +451,11 @@ load (char *file_name, void (**eip) (void), void **esp)
   struct process_meta *meta = t->meta;
 #ifdef VM
   /** try initialize file mapping table. */
-  meta->map_file_rt = map_file_init ();
-  if (meta->map_file_rt == NULL)
-    goto done;
-  
-  /** try initializing swap table. */
-  meta->swaptb = swaptb_create ();
-  if (meta->swaptb == NULL)
+  meta->map_file_tb = map_file_init ();
+  if (meta->map_file_tb == NULL)
     goto done;
 
-  /** try initializing the frame table. */
-  frametb_init (&meta->frametb);
+  frametb_quota_init (meta);
 #endif
 
   /* Zero out blanks, tabs in file_name */
@@ -650,7 +644,9 @@ load (char *file_name, void (**eip) (void), void **esp)
 
 /** load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /** Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -757,40 +753,28 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   return true;
 #else  // VM
   struct process_meta *meta = thread_current ()->meta;
-  void *rt = meta->map_file_rt;
-  while (zero_bytes > 0 || read_bytes > 0)
-    {
-      /* Calculate how to fill this page.
-         We will read PAGE_READ_BYTES bytes from FILE
-         and zero the final PAGE_ZERO_BYTES bytes. */
-      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-      size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-      /* Lazily map page */
-      struct map_file *mf = malloc (sizeof (struct map_file));
-      if (mf == NULL)  // allocation failure
-        return false;
 
-      /** initialize map_file obj */
-      mf->fobj = file_reopen (file); 
-      mf->writable = (short)writable;
-      mf->offset = ofs;
-      mf->read_bytes = page_read_bytes;
-      mf->mmap = (short)0;
-      if (!map_file (rt, mf, upage)) {
-        /** Oops, failure to create mapping */
-        return false;
-      }
+  /* Lazily map the whole segment as one area */
+  struct map_file *mf = malloc (sizeof (struct map_file));
+  if (mf == NULL)  // allocation failure
+    return false;
 
-      /** Advance */
-      ofs += page_read_bytes;
-      read_bytes -= page_read_bytes;
-      zero_bytes -= page_zero_bytes;
-      upage += PGSIZE;
-    }
+  /** initialize map_file obj */
+  mf->start = upage;
+  mf->end = upage + read_bytes + zero_bytes;
+  mf->fobj = file_reopen (file); 
+  mf->writable = (short)writable;
+  mf->offset = ofs;
+  mf->read_bytes = read_bytes;
+  mf->mmap = (short)0;
+  mf->mapid = -1;
+  if (mf->fobj == NULL) {
+    free (mf);
+    return false;
+  }
 
-  /* success */ 
-  return true;
+  /* Oops, failure to create mapping, e.g. segments overlap */
+  return map_file (meta->map_file_tb, mf);
 #endif // end of VM
 }
 
@@ -802,48 +786,26 @@ setup_stack (void **esp)
   uint8_t *kpage;
   bool success = false;
 
+#ifndef VM
   kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-
-  /* Hack the frame table a little... */
-#ifdef VM
-  struct thread *cur = thread_current ();
-  struct process_meta *meta = cur->meta;
-  struct frame_table *ftb = &meta->frametb;
-  ASSERT (ftb->free_ptr == 0);
-  ftb->free_ptr = 1;
-  ftb->pages[0] = kpage;
-  ftb->upages[0] = ((uint8_t *) PHYS_BASE) - PGSIZE;
-  void *kpage2 = palloc_get_page (PAL_USER);
-  if (kpage2 == NULL)
-    {
-      /* Cannot allocate even 2 user pages?? */
-      ftb->pages[0] = NULL;
-      ftb->upages[0] = NULL;
-      palloc_free_page (kpage);
-      /* Let frametb_free call palloc_free_page. */
-      return false;
-    }
-  
-  /* Successfully get 2 user pages. */
-  ftb->pages[1] = kpage2;
-  ftb->free_ptr = 2;
+#else
+  /* The frame table may hand out a page another process used. */
+  kpage = vm_alloc_page (1, ((uint8_t *) PHYS_BASE) - PGSIZE);
 #endif
 
   if (kpage != NULL) 
     {
+#ifndef VM
       success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
-      if (success)
-        *esp = PHYS_BASE;
-      else {
+      if (!success)
         palloc_free_page (kpage);
-
-        /* Note that in vm mode, we previously set the frame table. We
-          have to avoid double free. */
-#ifdef VM
-        ftb->pages[0] = NULL;
-        ftb->upages[0] = NULL;
+#else
+      /* vm_install_page frees the frame on failure. */
+      success = vm_install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage,
+                                 true);
 #endif
-      }
+      if (success)
+        *esp = PHYS_BASE;
     }
   return success;
 }
@@ -856,7 +818,9 @@ setup_stack (void **esp)
    KPAGE should probably be a page obtained from the user pool
    with palloc_get_page().
    Returns true on success, false if UPAGE is already mapped or
-   if memory allocation fails. */
+   if memory allocation fails.
+   With VM, vm_install_page does this for frames of the frame table. */
+#ifndef VM
 static bool
 install_page (void *upage, void *kpage, bool writable)
 {
@@ -867,6 +831,7 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
 
 /** Allocate a file descriptor. Returns -1 if not found */
 int 
@@ -886,6 +851,20 @@ fdalloc (void)
   return fd; 
 }
 
+/** Returns the open file of fd, NULL if fd is not a valid file. */
+struct file *
+fdfile (int fd)
+{
+  fd -= 2;
+  if (fd < 0 || fd >= MAX_FILE) {
+    /** invalid fd */
+    return NULL;
+  }
+
+  struct process_meta *m = thread_current ()->meta;
+  return m->ofile[fd];
+}
+
 /** Allocate file struct */
 struct file *
 filealloc (const char *fn)
@@ -938,6 +917,46 @@ fdseek (int fd, unsigned int pos)
   return 0;
 }
 
+/** Move the position of a given fd as lseek() does.
+   Returns the new position, -1 on failure. */
+int 
+fdlseek (int fd, int offset, int whence)
+{
+  fd -= 2;
+  struct process_meta *m = thread_current ()->meta;
+
+  /* Validate args. */
+  if (fd < 0 || fd >= MAX_FILE || m->ofile[fd] == NULL)
+    return -1;
+
+  struct file *file = m->ofile[fd];
+  off_t pos;
+  switch (whence)
+    {
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = file_tell (file) + offset;
+      break;
+    case SEEK_END:
+      pos = file_length (file) + offset;
+      break;
+    case SEEK_DATA:
+    case SEEK_HOLE:
+      pos = inode_seek_data (file_get_inode (file), offset, 
+                             whence == SEEK_HOLE);
+      break;
+    default:
+      return -1;
+    }
+  if (pos < 0)
+    return -1;
+
+  file_seek (file, pos);
+  return pos;
+}
+
 /** Tell the position of a given fd */
 int
 fdtell (int fd)
@@ -1008,6 +1027,36 @@ fdinum (int fd)
   return inode_num (ino);
 }
 
+/** Write the data of an open file back to disk, and its inode too
+   unless datasync is set. Returns 1 if successful. */
+int 
+fdsync (int fd, bool datasync)
+{
+  fd -= 2;
+  struct process_meta *m = thread_current ()->meta;
+
+  /* Validate args. */
+  if (fd < 0 || fd >= MAX_FILE || m->ofile[fd] == NULL)
+    return 0;
+
+  inode_sync (file_get_inode (m->ofile[fd]), datasync);
+  return 1;
+}
+
+/* Returns the number of blocks moved, -1 on failure. */
+int
+fddefrag (int fd)
+{
+  fd -= 2;
+  struct process_meta *m = thread_current ()->meta;
+
+  /* Validate args. */
+  if (fd < 0 || fd >= MAX_FILE || m->ofile[fd] == NULL)
+    return -1;
+
+  return inode_defrag (file_get_inode (m->ofile[fd]));
+}
+
 /* Returns 1 if successful. */
 int 
 fdrddir (int fd, char *kbuf)
@@ -1041,3 +1090,62 @@ fdrddir (int fd, char *kbuf)
 
   return ret;
 }
+
+/* Fill kbuf with as many packed struct dirent as fit in size bytes.
+   Returns the number of bytes used, 0 at the end of the directory, 
+   -1 on error or if not even one entry fits. */
+int 
+fdgetdents (int fd, char *kbuf, unsigned size)
+{
+  fd -= 2;
+  struct process_meta *m = thread_current ()->meta;
+
+  /* Validate args. */
+  if (fd < 0 || fd >= MAX_FILE || m->ofile[fd] == NULL)
+    return -1;
+  
+  /* Check inode. */
+  struct inode *ino = file_get_inode (m->ofile[fd]);
+  if (inode_typ (ino) != INODE_DIR) {
+    return -1;
+  }
+  
+  /* Open directory, seek to the position. */
+  struct dir *dir = dir_open (inode_reopen (ino));
+  if (dir == NULL)
+    return -1;
+  dir_seek (dir, file_tell (m->ofile[fd]));
+
+  char name[NAME_MAX + 1];
+  block_sector_t sec;
+  unsigned used = 0;
+  bool full = false;
+  int pos = dir_tell (dir);
+  while (dir_readdir_ino (dir, name, &sec)) {
+    const unsigned namlen = strlen (name);
+    const unsigned reclen = DIRENT_RECLEN (namlen);
+    if (used + reclen > size) {
+      /* Does not fit, leave it for the next call. */
+      dir_seek (dir, pos);
+      full = true;
+      break;
+    }
+
+    struct dirent *de = (struct dirent *) (kbuf + used);
+    struct inode *eino = inode_open (sec);
+    de->d_ino = sec;
+    de->d_reclen = reclen;
+    de->d_type = (eino != NULL && inode_typ (eino) == INODE_DIR) 
+               ? DT_DIR : DT_REG;
+    de->d_namlen = namlen;
+    memcpy (de->d_name, name, namlen + 1);
+    inode_close (eino);
+
+    used += reclen;
+    pos = dir_tell (dir);
+  }
+
+  file_seek (m->ofile[fd], dir_tell (dir));
+  dir_close (dir);
+  return (full && used == 0) ? -1 : (int) used;
+}
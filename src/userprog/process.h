@@ -29,10 +29,7 @@ typedef struct frame_entry
 struct file;
 struct map_file;
 /**< Definition in vm/vm-util.h */
-struct map_file;
-struct frame_table;
-struct swap_table_root;
-struct swap_table_dir;
+struct map_file_table;
 
 /** Metadata of a user process(put on stack) */
 struct process_meta
@@ -43,10 +40,12 @@ struct process_meta
     struct file    *executable; /**< Executable; must close on process_exit. */
     int             pwd;        /**< Present working directory */
 #ifdef VM  /**< Virtual memory is implemented! */
-    void           *map_file_rt;     /**< Root of file mapping table. */
-    struct swap_table_root *swaptb;  /**< Swap table */
-    struct frame_table      frametb; /**< Frame table */
-    void           *mmaptb[NMMAP];   /**< mmap table */
+    struct map_file_table *map_file_tb;  /**< File mapping table */
+    int             next_mapid;      /**< Id of the next mmap */
+    int             frame_cnt;       /**< Frames held */
+    int             frame_quota;     /**< Frames kept under pressure */
+    int             pff_faults;      /**< Faults in this PFF sample */
+    int64_t         pff_start;       /**< Tick the sample started */
 #endif
   };
 
@@ -73,10 +72,15 @@ int fdalloc (void);
 int fdfree (int);
 int fdseek (int, unsigned int);
 int fdtell (int);
+int fdlseek (int, int offset, int whence);
 int fdsize (int);
 int fdisdir (int);
 int fdinum (int);
+int fdsync (int, bool datasync);
+int fddefrag (int);
 int fdrddir (int fd, char *kbuf);
+int fdgetdents (int fd, char *kbuf, unsigned size);
 struct file *filealloc (const char *fn);
+struct file *fdfile (int);
 
 #endif /**< userprog/process.h */
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <syscall-nr.h>
+#include <uio.h>
 #include "threads/interrupt.h"
 #include "threads/malloc.h"
 #include "threads/pte.h"
@@ -107,13 +108,15 @@ struct list exec_process;
 /** Record return values of some thread(partially fix to process) */
 // int retvals[NPROC] UNUSED;
 
-/** Install pages on stack. */
+/** Install pages on stack. Like the page fault handler, only within
+   the stack zone from STACK_LOW up, where no mapping may lie. */
 static void
 sc_install_stack (uint32_t *pagetable, void *esp, void *start, void *end)
 {
   /* Validate arguments */
   ASSERT (start < end);
-  if (esp < 0x8048000 || end > PHYS_BASE || start < esp) {
+  if (esp < STACK_LOW || esp > PHYS_BASE || end > PHYS_BASE 
+      || start < esp) {
     /* Fail */
     return;
   }
@@ -129,16 +132,53 @@ sc_install_stack (uint32_t *pagetable, void *esp, void *start, void *end)
       /* Try allocate and install */
 #ifndef VM
       kaddr = palloc_get_page (PAL_USER);
-#else
-      kaddr = vm_alloc_page (0, page);
-#endif
       if (kaddr == NULL) {
         return;
       }
       pagedir_set_page (pagetable, page, kaddr, true);
+#else
+      kaddr = vm_alloc_page (1, page);
+      if (!vm_install_page (page, kaddr, true)) {
+        return;
+      }
+#endif
     }
 }
 
+/** Returns the kernel alias of user page upage, faulting it in first
+ * if needed (VM only). In VM mode the frame stays pinned until
+ * sc_unpin, since other processes may evict it otherwise.
+ * @param write if set, the page will be modified through the alias.
+ * @return NULL if upage cannot be brought in.
+ */
+static void *
+sc_pin (uint32_t *pagetable, void *upage, void *esp, int write)
+{
+#ifndef VM
+  (void) esp;
+  (void) write;
+  return pagedir_get_page (pagetable, upage);
+#else
+  void *kaddr;
+  while ((kaddr = vm_pin (pagetable, upage, write)) == NULL) {
+    if (!process_handle_pgfault (upage, esp))
+      return NULL;
+  }
+  return kaddr;
+#endif
+}
+
+/** Undo sc_pin, given any address in the kernel alias. */
+static void
+sc_unpin (const void *kaddr)
+{
+#ifndef VM
+  (void) kaddr;
+#else
+  vm_unpin ((void *) kaddr);
+#endif
+}
+
 /** Copy at most bytes from user space, return actual bytes copied.
  * @param pagetable pagetable to lookup.
  * @param uaddr start of user address to copy from.
@@ -165,17 +205,10 @@ copy_from_user (uint32_t *pagetable, void *uaddr, void *kbuf,
   unsigned int pgleft;        /**< bytes left in a page */
   for (; ptr < PHYS_BASE; )
     {
-      void *kaddr = pagedir_get_page (pagetable, ptr);
+      void *kaddr = sc_pin (pagetable, ptr, NULL, 0);
       if (kaddr == NULL) {
-#ifndef VM    /* +-+-+-+-+-+-+-+-+-+- not VM +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
         /* encounter page fault, abort(else will crash!) */
         return (bytes - left) | 0x80000000;
-#else         /* +-+-+-+-+-+-+-+-+-+- is VM +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
-        if (!process_handle_pgfault (ptr, NULL))
-          return (bytes - left) | 0x80000000;
-        kaddr = pagedir_get_page (pagetable, ptr);
-        ASSERT (kaddr != NULL);
-#endif        /* +-+-+-+-+-+-+-+-+-+- end VM +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
       }
 
       kaddr += uaddr - ptr;
@@ -196,10 +229,12 @@ copy_from_user (uint32_t *pagetable, void *uaddr, void *kbuf,
       /* copy min(pgleft, left) bytes into kernel buf */
       if (pgleft < left) {
         memmove (kbuf, kaddr, pgleft);
+        sc_unpin (kaddr);
         left -= pgleft;
         kbuf += pgleft;
       } else {
         memmove (kbuf, kaddr, left);
+        sc_unpin (kaddr);
         left = 0;
         /* ignore kbuf for now */
         break;
@@ -237,17 +272,10 @@ cpstr_from_user (uint32_t *pagetable, char *uaddr, char *kbuf,
   unsigned int bytes = 0;     /**< bytes write to kbuf */
   for (; ptr < PHYS_BASE; ) 
     {
-      void *kaddr = pagedir_get_page (pagetable, ptr);
+      char *kaddr = sc_pin (pagetable, ptr, NULL, 0);
       if (kaddr == NULL) {
-#ifndef VM    /* +-+-+-+-+-+-+-+-+-+- not VM +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
         /* encounter page fault, abort(else will crash!) */
         return 2;
-#else         /* +-+-+-+-+-+-+-+-+-+- is VM +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
-        if (!process_handle_pgfault (ptr, NULL))
-          return 2;
-        kaddr = pagedir_get_page (pagetable, ptr);
-        ASSERT (kaddr != NULL);  // ok, continue execution
-#endif        /* +-+-+-+-+-+-+-+-+-+- end VM +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
       }
 
       kaddr += uaddr - ptr;
@@ -257,15 +285,18 @@ cpstr_from_user (uint32_t *pagetable, char *uaddr, char *kbuf,
       for (unsigned i = 0; i < pgleft; ++i) {
         if (bytes == bufsz) {
           /* Overflow detected! */
+          sc_unpin (kaddr);
           return 1;
         }
-        *kbuf = *uaddr;
+        *kbuf = kaddr[i];
         ++bytes;
         if (*kbuf == '\0') {
+          sc_unpin (kaddr);
           return 0;
         }
-        ++kbuf;   ++uaddr;
+        ++kbuf;
       }
+      sc_unpin (kaddr);
 
       /* look into next page; update uaddr */
       ptr += PGSIZE;
@@ -303,32 +334,28 @@ copy_to_user (uint32_t *pagetable, void *kbuf, void *uaddr,
   unsigned int pgleft;        /**< bytes left in a page */
   for (; ptr < PHYS_BASE; )
     {
-      void *kaddr = pagedir_get_page (pagetable, ptr);
+      void *kaddr = sc_pin (pagetable, ptr, esp, 1);
       if (kaddr == NULL) {
-#ifndef VM    /* +-+-+-+-+-+-+-+-+-+- not VM +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
         /* encounter page fault, abort(else will crash!) */
         return 0x80000000 | (bytes - left);
-#else         /* +-+-+-+-+-+-+-+-+-+- is VM +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
-        if (!process_handle_pgfault (ptr, esp))
-          return 0x80000000 | (bytes - left);
-        kaddr = pagedir_get_page (pagetable, ptr);
-        /* Check invalid write */
-        ASSERT (kaddr != NULL);  // ok, continue execution
-#endif        /* +-+-+-+-+-+-+-+-+-+- end VM +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-*/
       }
       uint32_t *pte = pagedir_lookup (pagetable, ptr);
-        if ((*pte & PTE_W) == 0) /* Access violation */
+        if ((*pte & PTE_W) == 0) { /* Access violation */
+          sc_unpin (kaddr);
           return 0x80000000 | (bytes - left);
+        }
 
       kaddr += uaddr - ptr;
       pgleft = PGSIZE - (uaddr - ptr);
       /* copy min(pgleft, left) bytes into kernel buf */
       if (pgleft < left) {
         memmove (kaddr, kbuf, pgleft);
+        sc_unpin (kaddr);
         left -= pgleft;
         kbuf += pgleft;
       } else {
         memmove (kaddr, kbuf, left);
+        sc_unpin (kaddr);
         left = 0;
         /* ignore kbuf for now */
         break;
@@ -342,6 +369,118 @@ copy_to_user (uint32_t *pagetable, void *kbuf, void *uaddr,
   return bytes - left;
 }
 
+/** Returns the kernel alias of the user page containing uaddr,
+ * faulting it in first if needed (VM only). The caller must
+ * sc_unpin it when done.
+ * @param write if set, the user page must be writable.
+ * @return NULL on an invalid access.
+ */
+static void *
+sc_user_kaddr (uint32_t *pagetable, void *uaddr, void *esp, int write)
+{
+  if (!is_user_vaddr (uaddr))
+    return NULL;
+
+  void *page = pg_round_down (uaddr);
+  void *kaddr = sc_pin (pagetable, page, esp, write);
+  if (kaddr == NULL)
+    return NULL;
+  if (write && (*pagedir_lookup (pagetable, page) & PTE_W) == 0) {
+    sc_unpin (kaddr);
+    return NULL;   /* Access violation */
+  }
+
+  return kaddr + pg_ofs (uaddr);
+}
+
+/** Read up to len bytes of file at ofs into user buffer ubuf. Each
+ * page-bounded chunk goes from the pinned cache lines straight into 
+ * the kernel alias of the user page, with no bounce buffer. The user
+ * page is pinned meanwhile, so that no process evicts it.
+ * @return bytes read, 0x80000000 | bytes if ubuf is invalid.
+ */
+static unsigned int
+sc_read_at (struct file *file, char *ubuf, unsigned len, off_t ofs, 
+            void *esp)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  unsigned done = 0;
+  while (done < len) {
+    const unsigned pgleft = PGSIZE - pg_ofs (ubuf + done);
+    const unsigned chunk = (len - done) > pgleft ? pgleft : (len - done);
+    char *kaddr = sc_user_kaddr (pd, ubuf + done, esp, 1);
+    if (kaddr == NULL)
+      return 0x80000000 | done;
+    const off_t n = file_read_at (file, kaddr, chunk, ofs + done);
+    sc_unpin (kaddr);
+    if (n <= 0)
+      break;
+    done += n;
+    if ((unsigned) n < chunk)   /* End of file */
+      break;
+  }
+  return done;
+}
+
+/** Write up to len bytes from user buffer ubuf into file at ofs,
+ * straight from the kernel alias of each user page into the cache. 
+ * A NULL file means the console.
+ * @return bytes written, 0x80000000 | bytes if ubuf is invalid.
+ */
+static unsigned int
+sc_write_at (struct file *file, char *ubuf, unsigned len, off_t ofs, 
+             void *esp)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  unsigned done = 0;
+  while (done < len) {
+    const unsigned pgleft = PGSIZE - pg_ofs (ubuf + done);
+    const unsigned chunk = (len - done) > pgleft ? pgleft : (len - done);
+    const char *kaddr = sc_user_kaddr (pd, ubuf + done, esp, 0);
+    if (kaddr == NULL)
+      return 0x80000000 | done;
+    if (file == NULL) {
+      putbuf (kaddr, chunk);
+      sc_unpin (kaddr);
+      done += chunk;
+      continue;
+    }
+    const off_t n = file_write_at (file, kaddr, chunk, ofs + done);
+    sc_unpin (kaddr);
+    if (n <= 0)
+      break;
+    done += n;
+    if ((unsigned) n < chunk)   /* Disk full */
+      break;
+  }
+  return done;
+}
+
+/** Read at most len bytes from the console into user buffer ubuf,
+ * stopping after a newline.
+ * @return bytes read, 0x80000000 | bytes if ubuf is invalid.
+ */
+static unsigned int
+sc_read_console (char *ubuf, unsigned len, void *esp)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  unsigned done = 0;
+  while (done < len) {
+    char *kaddr = sc_user_kaddr (pd, ubuf + done, esp, 1);
+    if (kaddr == NULL)
+      return 0x80000000 | done;
+    char c = input_getc ();
+    if (c == '\r')
+      c = '\n';
+    *kaddr = c;
+    sc_unpin (kaddr);
+    ++done;
+    if (c == '\n')
+      break;
+  }
+  return done;
+}
+
 void
 syscall_init (void) 
 {
@@ -474,6 +613,18 @@ static int mkdir_executor (void *args);
 static int readdir_executor (void *args);
 static int isdir_executor (void *args);
 static int inumber_executor (void *args);
+static int getdents_executor (void *args);
+static int pread_executor (void *args);
+static int pwrite_executor (void *args);
+static int readv_executor (void *args);
+static int writev_executor (void *args);
+static int copy_file_range_executor (void *args);
+static int directio_executor (void *args);
+static int fsync_executor (void *args);
+static int fdatasync_executor (void *args);
+static int lseek_executor (void *args);
+static int reflink_executor (void *args);
+static int defrag_executor (void *args);
 
 /** list of implemented system calls */
 static syscall_executor_t syscall_executors[] = 
@@ -498,6 +649,18 @@ static syscall_executor_t syscall_executors[] =
     [SYS_READDIR] readdir_executor,
     [SYS_ISDIR] isdir_executor,
     [SYS_INUMBER] inumber_executor,
+    [SYS_GETDENTS] getdents_executor,
+    [SYS_PREAD] pread_executor,
+    [SYS_PWRITE] pwrite_executor,
+    [SYS_READV] readv_executor,
+    [SYS_WRITEV] writev_executor,
+    [SYS_COPY_FILE_RANGE] copy_file_range_executor,
+    [SYS_DIRECTIO] directio_executor,
+    [SYS_FSYNC] fsync_executor,
+    [SYS_FDATASYNC] fdatasync_executor,
+    [SYS_LSEEK] lseek_executor,
+    [SYS_REFLINK] reflink_executor,
+    [SYS_DEFRAG] defrag_executor,
   };
 
 /** Number of implemented system calls(to detect overflow) */
@@ -815,52 +978,29 @@ read_executor (void *args)
     return -1;
   }
 
-  /* make a kernel buffer, and print to console */
   if (len == 0) {
     return 0;
   }
-  char *kbuf = (char *) malloc (len);
-  if (kbuf == NULL) {
-    return -1;
-  }
 
-  unsigned ret = 0;
+  /* No kernel buffer: data goes straight into the user pages. */
+  unsigned ret;
   if (fd == 0) {
     /* read len bytes from console */
-    for (ret = 0; ret < len; ++ret) {
-      kbuf[ret] = input_getc ();
-      if (kbuf[ret] == '\n' || kbuf[ret] == '\r') {
-        kbuf[ret] = '\n';
-        ++ret;
-        break;
-      }
-    }
+    ret = sc_read_console (ubuf, len, f->esp);
   } else {
     if (fd == 1) {
       /* Read stdout??? IMPOSSIBLE! */
       return -1;
     }
-    struct process_meta *m = cur->meta;
-    fd -= 2;
-    if (fd >= MAX_FILE || fd < 0 || m->ofile[fd] == NULL) {
+    struct file *file = fdfile (fd);
+    if (file == NULL || fdisdir (fd)) {
       /* invalid fd */
-      free (kbuf);
-      return -1;
-    }
-    int fret = file_read (m->ofile[fd], kbuf, len);
-    if (fret < 0) {
-      /* Warning: unsafe conversion from signed to unsigned */
-      free (kbuf);
       return -1;
     }
-    ret = fret;
+    const off_t pos = file_tell (file);
+    ret = sc_read_at (file, ubuf, len, pos, f->esp);
+    file_seek (file, pos + (ret & ~0x80000000));
   }
-  if (ret) {
-    /* If ret == 0(unusual condition), then don't have to install stack! */
-    // sc_install_stack (cur->pagedir, f->esp, ubuf, ubuf + ret);
-  }
-  ret = copy_to_user (cur->pagedir, kbuf, ubuf, ret, f->esp);
-  free (kbuf);
   if (ret & 0x80000000) {
     /* page fault detected! */
     process_terminate (-1);
@@ -901,51 +1041,34 @@ write_executor (void *args)
     return -1;
   }
 
-  /* make a kernel buffer, and print to console */
   if (len == 0) {
     return 0;
   }
-  char *kbuf = (char *) malloc (len + 1);
-  if (kbuf == NULL) {
-    return -1;
-  }
-  kbuf[len] = '\0';
 
-  if (len != 0) {
-    // sc_install_stack (cur->pagedir, f->esp, ubuf, ubuf + len);
-  }
-  unsigned ret = copy_from_user (cur->pagedir, ubuf, kbuf, len);
-  if (ret & 0x80000000) {
-    /* page fault encountered */
-    process_terminate (-1);
-  }
-  if (fd == 1) {
-    printf ("%s", kbuf);
-  } else {
+  /* No kernel buffer: data goes straight from the user pages. */
+  struct file *file = NULL;
+  if (fd != 1) {
     if (fd == 0) {
       /* Write stdin ??? IMPOSSIBLE! */
       return -1;
     }
-    struct process_meta *m = cur->meta;
-    fd -= 2;
-    if (fd >= MAX_FILE || fd < 0 || m->ofile[fd] == NULL) {
+    file = fdfile (fd);
+    if (file == NULL || fdisdir (fd)) {
       /* invalid fd */
-      free (kbuf);
       return -1;
     }
-    if (!file_writable (m->ofile[fd])) {
-      free (kbuf);
+    if (!file_writable (file)) {
       return 0;
     }
-    int fret = file_write (m->ofile[fd], kbuf, len);
-    if (fret < 0) {
-      /* Warning: unsafe conversion from signed to unsigned */
-      free (kbuf);
-      return -1;
-    }
-    ret = fret;
   }
-  free (kbuf);
+  const off_t pos = file != NULL ? file_tell (file) : 0;
+  unsigned ret = sc_write_at (file, ubuf, len, pos, f->esp);
+  if (ret & 0x80000000) {
+    /* page fault encountered */
+    process_terminate (-1);
+  }
+  if (file != NULL)
+    file_seek (file, pos + ret);
 
   return ret;
 }
@@ -1240,3 +1363,385 @@ inum_fail:
   /* not implemented */
   return -1;
 }
+
+static int 
+getdents_executor (void *args)
+{
+  /* Hint: int getdents (int fd, void *buffer, unsigned size) */
+  struct intr_frame *f = args;
+  void *argv = syscall_args (f);
+
+  /* Parse args */
+  unsigned int bytes;
+  int fd;
+  char *uaddr;
+  unsigned size;
+  struct thread *cur = thread_current ();
+  bytes = copy_from_user (cur->pagedir, argv, &fd, sizeof (fd));
+  if (bytes != sizeof (fd))
+    process_terminate (-1);
+  bytes = copy_from_user (cur->pagedir, argv + 4, &uaddr, sizeof (uaddr));
+  if (bytes != sizeof (uaddr))
+    process_terminate (-1);
+  bytes = copy_from_user (cur->pagedir, argv + 8, &size, sizeof (size));
+  if (bytes != sizeof (size))
+    process_terminate (-1);
+
+  /* One page of entries per call is plenty. */
+  if (size > PGSIZE)
+    size = PGSIZE;
+  char *kbuf = palloc_get_page (0);
+  if (kbuf == NULL)
+    return -1;
+
+  /* Fill the kernel buffer */
+  int ret = fdgetdents (fd, kbuf, size);
+  if (ret > 0) {
+    bytes = copy_to_user (cur->pagedir, kbuf, uaddr, ret, f->esp);
+    if (bytes != (unsigned) ret) {
+      palloc_free_page (kbuf);
+      process_terminate (-1);
+    }
+  }
+
+  palloc_free_page (kbuf);
+  return ret;
+}
+
+/** Parse the (fd, buffer, length, offset) arguments of pread and 
+   pwrite. Terminates the process on a bad argument pointer. Returns
+   false if the range [offset, offset + length) does not fit in an
+   off_t. */
+static bool
+sc_parse_pio (struct intr_frame *f, int *fd, char **ubuf, unsigned *len,
+              unsigned *ofs)
+{
+  void *argv = syscall_args (f);
+  uint32_t *pd = thread_current ()->pagedir;
+  if (copy_from_user (pd, argv, fd, sizeof (*fd)) != sizeof (*fd)
+      || copy_from_user (pd, argv + 4, ubuf, sizeof (*ubuf)) 
+         != sizeof (*ubuf)
+      || copy_from_user (pd, argv + 8, len, sizeof (*len)) != sizeof (*len)
+      || copy_from_user (pd, argv + 12, ofs, sizeof (*ofs)) 
+         != sizeof (*ofs))
+    process_terminate (-1);
+  return *ofs <= INT32_MAX && *len <= INT32_MAX - *ofs;
+}
+
+static int 
+pread_executor (void *args)
+{
+  /* Hint: int pread (int fd, void *buffer, unsigned length, 
+                      unsigned offset) */
+  struct intr_frame *f = args;
+  int fd;
+  char *ubuf;
+  unsigned len, ofs;
+  if (!sc_parse_pio (f, &fd, &ubuf, &len, &ofs))
+    return -1;
+
+  /* Does not touch the file position. */
+  struct file *file = fdfile (fd);
+  if (file == NULL)
+    return -1;
+  if (fdisdir (fd))
+    return -1;
+
+  unsigned ret = sc_read_at (file, ubuf, len, ofs, f->esp);
+  if (ret & 0x80000000)
+    process_terminate (-1);
+  return ret;
+}
+
+static int 
+pwrite_executor (void *args)
+{
+  /* Hint: int pwrite (int fd, const void *buffer, unsigned length, 
+                       unsigned offset) */
+  struct intr_frame *f = args;
+  int fd;
+  char *ubuf;
+  unsigned len, ofs;
+  if (!sc_parse_pio (f, &fd, &ubuf, &len, &ofs))
+    return -1;
+
+  /* Does not touch the file position. */
+  struct file *file = fdfile (fd);
+  if (file == NULL)
+    return -1;
+  if (fdisdir (fd))
+    return -1;
+  if (!file_writable (file))
+    return 0;
+
+  unsigned ret = sc_write_at (file, ubuf, len, ofs, f->esp);
+  if (ret & 0x80000000)
+    process_terminate (-1);
+  return ret;
+}
+
+/** Parse the (fd, iov, iovcnt) arguments of readv and writev, and
+   copy the iovec array into kiov. Terminates the process on a bad 
+   pointer. 
+   @return iovcnt, or -1 if it is out of range. */
+static int
+sc_parse_iov (struct intr_frame *f, int *fd, struct iovec kiov[IOV_MAX])
+{
+  void *argv = syscall_args (f);
+  uint32_t *pd = thread_current ()->pagedir;
+  struct iovec *uiov;
+  int cnt;
+  if (copy_from_user (pd, argv, fd, sizeof (*fd)) != sizeof (*fd)
+      || copy_from_user (pd, argv + 4, &uiov, sizeof (uiov)) 
+         != sizeof (uiov)
+      || copy_from_user (pd, argv + 8, &cnt, sizeof (cnt)) != sizeof (cnt))
+    process_terminate (-1);
+  if (cnt < 0 || cnt > IOV_MAX)
+    return -1;
+
+  const unsigned bytes = cnt * sizeof (struct iovec);
+  if (cnt > 0 && copy_from_user (pd, uiov, kiov, bytes) != bytes)
+    process_terminate (-1);
+  return cnt;
+}
+
+static int 
+readv_executor (void *args)
+{
+  /* Hint: int readv (int fd, const struct iovec *iov, int iovcnt) */
+  struct intr_frame *f = args;
+  struct iovec kiov[IOV_MAX];
+  int fd;
+  const int cnt = sc_parse_iov (f, &fd, kiov);
+  struct file *file = fdfile (fd);
+  if (cnt < 0 || file == NULL || fdisdir (fd))
+    return -1;
+
+  /* Scatter from the current position, then advance it once. */
+  const off_t pos = file_tell (file);
+  unsigned total = 0;
+  for (int i = 0; i < cnt; ++i) {
+    const unsigned n = sc_read_at (file, kiov[i].iov_base, 
+                                   kiov[i].iov_len, pos + total, f->esp);
+    if (n & 0x80000000)
+      process_terminate (-1);
+    total += n;
+    if (n < kiov[i].iov_len)
+      break;
+  }
+  file_seek (file, pos + total);
+
+  return total;
+}
+
+static int 
+writev_executor (void *args)
+{
+  /* Hint: int writev (int fd, const struct iovec *iov, int iovcnt) */
+  struct intr_frame *f = args;
+  struct iovec kiov[IOV_MAX];
+  int fd;
+  const int cnt = sc_parse_iov (f, &fd, kiov);
+  if (cnt < 0)
+    return -1;
+
+  /* fd 1 is the console, see sc_write_at. */
+  struct file *file = NULL;
+  if (fd != 1) {
+    file = fdfile (fd);
+    if (file == NULL || fdisdir (fd))
+      return -1;
+    if (!file_writable (file))
+      return 0;
+  }
+
+  /* Gather at the current position, then advance it once. */
+  const off_t pos = file != NULL ? file_tell (file) : 0;
+  unsigned total = 0;
+  for (int i = 0; i < cnt; ++i) {
+    const unsigned n = sc_write_at (file, kiov[i].iov_base, 
+                                    kiov[i].iov_len, pos + total, f->esp);
+    if (n & 0x80000000)
+      process_terminate (-1);
+    total += n;
+    if (n < kiov[i].iov_len)
+      break;
+  }
+  if (file != NULL)
+    file_seek (file, pos + total);
+
+  return total;
+}
+
+static int 
+copy_file_range_executor (void *args)
+{
+  /* Hint: int copy_file_range (int fd_in, int fd_out, unsigned length) */
+  struct intr_frame *f = args;
+  void *argv = syscall_args (f);
+
+  /* Parse args */
+  unsigned int bytes;
+  int fd_in, fd_out;
+  unsigned len;
+  struct thread *cur = thread_current ();
+  bytes = copy_from_user (cur->pagedir, argv, &fd_in, sizeof (fd_in));
+  if (bytes != sizeof (fd_in))
+    process_terminate (-1);
+  bytes = copy_from_user (cur->pagedir, argv + 4, &fd_out, sizeof (fd_out));
+  if (bytes != sizeof (fd_out))
+    process_terminate (-1);
+  bytes = copy_from_user (cur->pagedir, argv + 8, &len, sizeof (len));
+  if (bytes != sizeof (len))
+    process_terminate (-1);
+
+  struct file *in = fdfile (fd_in);
+  struct file *out = fdfile (fd_out);
+  if (in == NULL || out == NULL)
+    return -1;
+  if (!file_writable (out))
+    return 0;
+
+  /* Data never leaves the kernel. */
+  return file_copy (out, in, len);
+}
+
+static int 
+directio_executor (void *args)
+{
+  /* Hint: bool directio (int fd, bool enable) */
+  struct intr_frame *f = args;
+  void *argv = syscall_args (f);
+
+  /* Parse args */
+  unsigned int bytes;
+  int fd, enable;
+  struct thread *cur = thread_current ();
+  bytes = copy_from_user (cur->pagedir, argv, &fd, sizeof (fd));
+  if (bytes != sizeof (fd))
+    process_terminate (-1);
+  bytes = copy_from_user (cur->pagedir, argv + 4, &enable, sizeof (enable));
+  if (bytes != sizeof (enable))
+    process_terminate (-1);
+
+  /* Only regular files have blocks to transfer. */
+  struct file *file = fdfile (fd);
+  if (file == NULL || fdisdir (fd))
+    return 0;
+  file_set_direct (file, enable != 0);
+  return 1;
+}
+
+static int 
+fsync_executor (void *args)
+{
+  /* Hint: bool fsync (int fd) */
+  struct intr_frame *f = args;
+  void *argv = syscall_args (f);
+
+  /* Parse args */
+  int fd;
+  struct thread *cur = thread_current ();
+  unsigned int bytes = copy_from_user (cur->pagedir, argv, &fd, sizeof (fd));
+  if (bytes != sizeof (fd))
+    process_terminate (-1);
+
+  return fdsync (fd, false);
+}
+
+static int 
+fdatasync_executor (void *args)
+{
+  /* Hint: bool fdatasync (int fd) */
+  struct intr_frame *f = args;
+  void *argv = syscall_args (f);
+
+  /* Parse args */
+  int fd;
+  struct thread *cur = thread_current ();
+  unsigned int bytes = copy_from_user (cur->pagedir, argv, &fd, sizeof (fd));
+  if (bytes != sizeof (fd))
+    process_terminate (-1);
+
+  /* Skips the inode unless the size or block map changed. */
+  return fdsync (fd, true);
+}
+
+static int 
+lseek_executor (void *args)
+{
+  /* Hint: int lseek (int fd, int offset, int whence) */
+  struct intr_frame *f = args;
+  void *argv = syscall_args (f);
+
+  /* Parse args */
+  unsigned int bytes;
+  int fd, offset, whence;
+  struct thread *cur = thread_current ();
+  bytes = copy_from_user (cur->pagedir, argv, &fd, sizeof (fd));
+  if (bytes != sizeof (fd))
+    process_terminate (-1);
+  bytes = copy_from_user (cur->pagedir, argv + 4, &offset, sizeof (offset));
+  if (bytes != sizeof (offset))
+    process_terminate (-1);
+  bytes = copy_from_user (cur->pagedir, argv + 8, &whence, sizeof (whence));
+  if (bytes != sizeof (whence))
+    process_terminate (-1);
+
+  return fdlseek (fd, offset, whence);
+}
+
+static int 
+reflink_executor (void *args)
+{
+  /* Hint: bool reflink (int fd, const char *file) */
+  struct intr_frame *f = args;
+  void *argv = syscall_args (f);
+  char kbuf[16 * 16];
+  struct thread *cur = thread_current ();
+
+  /* Parse args */
+  int fd;
+  char *uaddr;
+  unsigned int bytes;
+  sc_install_stack (cur->pagedir, f->esp, argv, argv + 8);
+  bytes = copy_from_user (cur->pagedir, argv, &fd, sizeof (fd));
+  if (bytes != sizeof (fd))
+    process_terminate (-1);
+  bytes = copy_from_user (cur->pagedir, argv + 4, &uaddr, sizeof (uaddr));
+  if (bytes != sizeof (uaddr))
+    process_terminate (-1);
+  sc_install_stack (cur->pagedir, f->esp, uaddr, uaddr + sizeof (kbuf));
+  bytes = cpstr_from_user (cur->pagedir, uaddr, kbuf, sizeof (kbuf));
+  switch (bytes) {
+    case 1: {
+      return 0;
+    }
+    case 2: {
+      process_terminate (-1);
+    }
+  }
+
+  /* The new file shares the data blocks of fd. */
+  struct file *file = fdfile (fd);
+  if (file == NULL)
+    return 0;
+  return fs_reflink (file_get_inode (file), kbuf);
+}
+
+static int 
+defrag_executor (void *args)
+{
+  /* Hint: int defrag (int fd) */
+  struct intr_frame *f = args;
+  void *argv = syscall_args (f);
+
+  /* Parse args */
+  int fd;
+  struct thread *cur = thread_current ();
+  unsigned int bytes = copy_from_user (cur->pagedir, argv, &fd, sizeof (fd));
+  if (bytes != sizeof (fd))
+    process_terminate (-1);
+
+  return fddefrag (fd);
+}
@@ -0,0 +1,509 @@
+/** pintos-mkfs.c
+
+   Builds a formatted Pintos file system image on the host, holding
+   the given files and directories, so that they need not be
+   extracted from the scratch disk at every boot.  The image is the
+   raw contents of a file system partition:
+
+       pintos-mkfs fs.dsk echo cat tests/
+       pintos --filesys=fs.dsk -- run 'echo x'
+
+   (Do not pass -f to the kernel, that would format the image.)
+
+   The layout written here must match filesys/inode.c,
+   filesys/directory.c and filesys/free-map.c. */
+
+#define _GNU_SOURCE 1
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SECTOR_SIZE 512         /**< BLOCK_SECTOR_SIZE. */
+#define FS_NAME_MAX 14          /**< Longest file name component. */
+
+/** Sectors of system file inodes, as in filesys/filesys.h. */
+#define FREE_MAP_SECTOR 0
+#define ROOT_DIR_SECTOR 1
+#define REFCNT_SECTOR 2
+
+/** Inode types, as in filesys/inode.h. */
+#define INODE_FILE 1
+#define INODE_DIR 2
+
+#define INODE_MAGIC 0x10203040  /**< Marks a sector as an inode. */
+#define INODE_INVALID (-1)      /**< Address of a block not on disk. */
+#define INODE_F_INLINE 0x1      /**< Data is stored in the inode. */
+#define INLINE_SIZE (125 * 4)   /**< Largest inline file. */
+
+/** Free map layout, as in filesys/free-map.c. */
+#define FREE_MAP_START (REFCNT_SECTOR + 1)
+#define GROUP_BITS (SECTOR_SIZE * 8)
+#define FREE_MAP_MAGIC 0x46524545
+
+/** Start of the free map summary. */
+struct free_map_header
+  {
+    uint32_t magic;             /**< FREE_MAP_MAGIC. */
+    uint32_t sector_cnt;        /**< Sectors on the device. */
+    uint32_t group_cnt;         /**< Number of groups. */
+    uint16_t free[];            /**< Free sectors per group. */
+  };
+
+/** On-disk inode. */
+struct inode_disk
+  {
+    uint8_t type;               /**< INODE_FILE or INODE_DIR. */
+    uint8_t flags;              /**< INODE_F_*. */
+    int16_t nlink;              /**< Number of links to inode. */
+    int32_t size;               /**< Size of file in bytes. */
+    union
+      {
+        int32_t addrs[125];     /**< 123 direct, 1 single, 1 double. */
+        uint8_t inline_data[INLINE_SIZE];
+      };
+    uint32_t magic;             /**< INODE_MAGIC. */
+  };
+
+/** Indirect block. */
+struct indirect_block
+  {
+    int32_t addrs[128];
+  };
+
+/** Directory entry. */
+struct dir_entry
+  {
+    uint32_t inode_sector;      /**< Sector of the entry's inode. */
+    char name[FS_NAME_MAX + 1]; /**< Null terminated file name. */
+    uint8_t in_use;             /**< In use or free? */
+  };
+
+_Static_assert (sizeof (struct inode_disk) == SECTOR_SIZE, "inode_disk");
+_Static_assert (sizeof (struct indirect_block) == SECTOR_SIZE, "indirect");
+_Static_assert (sizeof (struct dir_entry) == 20, "dir_entry");
+
+static uint8_t *disk;           /**< Image being built. */
+static uint32_t sector_cnt;     /**< Sectors in the image. */
+static uint32_t next_free;      /**< Sectors below are allocated. */
+
+static void
+fail (const char *msg, ...)
+     __attribute__ ((noreturn))
+     __attribute__ ((format (printf, 1, 2)));
+
+/** Prints MSG, formatting as with printf(),
+   plus an error message based on errno if nonzero,
+   and exits. */
+static void
+fail (const char *msg, ...)
+{
+  va_list args;
+
+  va_start (args, msg);
+  fprintf (stderr, "pintos-mkfs: ");
+  vfprintf (stderr, msg, args);
+  va_end (args);
+
+  if (errno != 0)
+    fprintf (stderr, ": %s", strerror (errno));
+  putc ('\n', stderr);
+  exit (EXIT_FAILURE);
+}
+
+/** Returns the contents of sector SEC. */
+static void *
+sector (uint32_t sec)
+{
+  return disk + (size_t) sec * SECTOR_SIZE;
+}
+
+/** Allocates the next free sector. */
+static uint32_t
+alloc_sector (void)
+{
+  if (next_free >= sector_cnt)
+    {
+      errno = 0;
+      fail ("file system full, use a larger --size");
+    }
+  return next_free++;
+}
+
+/** Returns the indirect block at *SLOT, allocating it if needed. */
+static struct indirect_block *
+indirect (int32_t *slot)
+{
+  if (*slot == INODE_INVALID)
+    {
+      struct indirect_block *ind;
+      int i;
+
+      *slot = alloc_sector ();
+      ind = sector (*slot);
+      for (i = 0; i < 128; i++)
+        ind->addrs[i] = INODE_INVALID;
+    }
+  return sector (*slot);
+}
+
+/** Returns the slot holding the address of block IDX of DI. */
+static int32_t *
+block_slot (struct inode_disk *di, uint32_t idx)
+{
+  struct indirect_block *first;
+
+  if (idx < 123)
+    return &di->addrs[idx];
+  idx -= 123;
+  if (idx < 128)
+    return &indirect (&di->addrs[123])->addrs[idx];
+  idx -= 128;
+  if (idx >= 128 * 128)
+    {
+      errno = 0;
+      fail ("file too large");
+    }
+  first = indirect (&di->addrs[124]);
+  return &indirect (&first->addrs[idx / 128])->addrs[idx % 128];
+}
+
+/** Returns true if the SIZE bytes at P are all zero. */
+static bool
+all_zero (const uint8_t *p, size_t size)
+{
+  while (size-- > 0)
+    if (*p++ != 0)
+      return false;
+  return true;
+}
+
+/** Makes sector SEC an inode of the given TYPE. */
+static void
+inode_init (uint32_t sec, int type, int32_t size)
+{
+  struct inode_disk *di = sector (sec);
+  int i;
+
+  memset (di, 0, sizeof *di);
+  di->type = type;
+  di->nlink = 1;
+  di->size = size;
+  di->magic = INODE_MAGIC;
+  if (size <= INLINE_SIZE)
+    di->flags = INODE_F_INLINE;
+  else
+    for (i = 0; i < 125; i++)
+      di->addrs[i] = INODE_INVALID;
+}
+
+/** Stores the SIZE bytes of DATA as the contents of the inode at
+   SEC, allocating blocks that are not on disk yet.  If SPARSE,
+   blocks of zeros are left unallocated. */
+static void
+inode_write (uint32_t sec, const uint8_t *data, int32_t size, bool sparse)
+{
+  struct inode_disk *di = sector (sec);
+  uint32_t idx;
+
+  if (di->flags & INODE_F_INLINE)
+    {
+      memcpy (di->inline_data, data, size);
+      return;
+    }
+
+  for (idx = 0; (int32_t) (idx * SECTOR_SIZE) < size; idx++)
+    {
+      const uint8_t *block = data + idx * SECTOR_SIZE;
+      size_t len = size - idx * SECTOR_SIZE;
+      int32_t *slot;
+
+      if (len > SECTOR_SIZE)
+        len = SECTOR_SIZE;
+      slot = block_slot (di, idx);
+      if (*slot == INODE_INVALID)
+        {
+          if (sparse && all_zero (block, len))
+            continue;
+          *slot = alloc_sector ();
+        }
+      memcpy (sector (*slot), block, len);
+    }
+}
+
+/** Reads host file NAME into memory, storing its size in *SIZE. */
+static uint8_t *
+read_file (const char *name, int32_t *size)
+{
+  FILE *file = fopen (name, "rb");
+  struct stat st;
+  uint8_t *data;
+
+  if (file == NULL || fstat (fileno (file), &st) < 0)
+    fail ("%s", name);
+  if (st.st_size > INT32_MAX)
+    {
+      errno = 0;
+      fail ("%s: file too large", name);
+    }
+  data = malloc (st.st_size + 1);
+  if (data == NULL)
+    fail ("out of memory");
+  if (fread (data, 1, st.st_size, file) != (size_t) st.st_size)
+    fail ("%s: read failed", name);
+  fclose (file);
+  *size = st.st_size;
+  return data;
+}
+
+/** A directory being built. */
+struct dir
+  {
+    struct dir_entry *entries;
+    size_t cnt, cap;
+  };
+
+/** Adds entry NAME for the inode at SEC to DIR. */
+static void
+dir_add (struct dir *dir, const char *name, uint32_t sec)
+{
+  struct dir_entry *e;
+
+  if (strlen (name) > FS_NAME_MAX)
+    {
+      errno = 0;
+      fail ("%s: name longer than %d characters", name, FS_NAME_MAX);
+    }
+  if (dir->cnt == dir->cap)
+    {
+      dir->cap = dir->cap ? dir->cap * 2 : 16;
+      dir->entries = realloc (dir->entries, dir->cap * sizeof *e);
+      if (dir->entries == NULL)
+        fail ("out of memory");
+    }
+  e = &dir->entries[dir->cnt++];
+  memset (e, 0, sizeof *e);
+  e->inode_sector = sec;
+  strcpy (e->name, name);
+  e->in_use = 1;
+}
+
+/** Writes DIR as the contents of the directory inode at SEC. */
+static void
+dir_write (uint32_t sec, struct dir *dir)
+{
+  const int32_t size = dir->cnt * sizeof (struct dir_entry);
+
+  inode_init (sec, INODE_DIR, size);
+  inode_write (sec, (const uint8_t *) dir->entries, size, false);
+  free (dir->entries);
+}
+
+static uint32_t add_path (const char *path, uint32_t parent);
+
+/** Copies host directory PATH into the directory inode at SEC, whose
+   parent is at PARENT. */
+static void
+add_dir (const char *path, uint32_t sec, uint32_t parent)
+{
+  struct dir dir = { NULL, 0, 0 };
+  struct dirent **names;
+  int i, n;
+
+  dir_add (&dir, ".", sec);
+  dir_add (&dir, "..", parent);
+
+  n = scandir (path, &names, NULL, alphasort);
+  if (n < 0)
+    fail ("%s", path);
+  for (i = 0; i < n; i++)
+    {
+      const char *name = names[i]->d_name;
+      if (strcmp (name, ".") && strcmp (name, ".."))
+        {
+          char *child;
+          uint32_t child_sec;
+
+          if (asprintf (&child, "%s/%s", path, name) < 0)
+            fail ("out of memory");
+          child_sec = add_path (child, sec);
+          if (child_sec != (uint32_t) INODE_INVALID)
+            dir_add (&dir, name, child_sec);
+          free (child);
+        }
+      free (names[i]);
+    }
+  free (names);
+  dir_write (sec, &dir);
+}
+
+/** Copies host file or directory PATH into a new inode and returns
+   its sector, or INODE_INVALID if PATH is of another kind.  PARENT
+   is the sector of the directory that will hold it. */
+static uint32_t
+add_path (const char *path, uint32_t parent)
+{
+  struct stat st;
+  uint32_t sec;
+
+  if (stat (path, &st) < 0)
+    fail ("%s", path);
+  if (S_ISREG (st.st_mode))
+    {
+      int32_t size;
+      uint8_t *data = read_file (path, &size);
+
+      sec = alloc_sector ();
+      inode_init (sec, INODE_FILE, size);
+      inode_write (sec, data, size, true);
+      free (data);
+    }
+  else if (S_ISDIR (st.st_mode))
+    {
+      sec = alloc_sector ();
+      add_dir (path, sec, parent);
+    }
+  else
+    {
+      fprintf (stderr, "pintos-mkfs: %s: skipping special file\n", path);
+      return INODE_INVALID;
+    }
+  return sec;
+}
+
+static void usage (int exit_code) __attribute__ ((noreturn));
+
+/** Prints a help message and exits with EXIT_CODE. */
+static void
+usage (int exit_code)
+{
+  printf ("pintos-mkfs, a tool for building Pintos file system images\n"
+          "Usage: pintos-mkfs [OPTION...] IMAGE [FILE...]\n"
+          "Writes a formatted file system to IMAGE, which must not exist.\n"
+          "Each FILE is copied into the root directory under its own\n"
+          "name; directories are copied with their contents.\n"
+          "Options:\n"
+          "  -s, --size=MB  Make the file system MB megabytes (default 2).\n"
+          "  -h, --help     Display this help message.\n");
+  exit (exit_code);
+}
+
+int
+main (int argc, char *argv[])
+{
+  static const struct option options[] =
+    {
+      {"size", required_argument, NULL, 's'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+    };
+  double size_mb = 2;
+  struct dir root = { NULL, 0, 0 };
+  const char *image;
+  uint32_t group_cnt, hdr_cnt, g, sec;
+  struct free_map_header *hdr;
+  FILE *out;
+  int c, i;
+
+  while ((c = getopt_long (argc, argv, "s:h", options, NULL)) != -1)
+    switch (c)
+      {
+      case 's':
+        size_mb = atof (optarg);
+        break;
+      case 'h':
+        usage (EXIT_SUCCESS);
+      default:
+        usage (EXIT_FAILURE);
+      }
+  if (optind >= argc)
+    usage (EXIT_FAILURE);
+  image = argv[optind++];
+  if (access (image, F_OK) == 0)
+    {
+      errno = 0;
+      fail ("%s: already exists", image);
+    }
+
+  sector_cnt = size_mb * 1024 * 1024 / SECTOR_SIZE;
+  if (sector_cnt < 16)
+    {
+      errno = 0;
+      fail ("file system too small");
+    }
+  disk = calloc (sector_cnt, SECTOR_SIZE);
+  if (disk == NULL)
+    fail ("out of memory");
+
+  /* Free map file, a run of sectors from FREE_MAP_START: the
+     summary, then one bitmap sector per group. */
+  group_cnt = (sector_cnt + GROUP_BITS - 1) / GROUP_BITS;
+  hdr_cnt = (sizeof *hdr + group_cnt * sizeof (uint16_t) + SECTOR_SIZE - 1)
+            / SECTOR_SIZE;
+  next_free = FREE_MAP_START + hdr_cnt + group_cnt;
+  if (next_free >= sector_cnt)
+    {
+      errno = 0;
+      fail ("file system too small");
+    }
+  inode_init (FREE_MAP_SECTOR, INODE_FILE,
+              (hdr_cnt + group_cnt) * SECTOR_SIZE);
+  for (i = 0; (uint32_t) i < hdr_cnt + group_cnt; i++)
+    *block_slot (sector (FREE_MAP_SECTOR), i) = FREE_MAP_START + i;
+
+  /* Empty refcount file. */
+  inode_init (REFCNT_SECTOR, INODE_FILE, 0);
+
+  /* Root directory, which has no "." or ".." entries. */
+  for (i = optind; i < argc; i++)
+    {
+      char *copy = strdup (argv[i]);
+      uint32_t child;
+
+      if (copy == NULL)
+        fail ("out of memory");
+      child = add_path (argv[i], ROOT_DIR_SECTOR);
+      if (child != (uint32_t) INODE_INVALID)
+        dir_add (&root, basename (copy), child);
+      free (copy);
+    }
+  dir_write (ROOT_DIR_SECTOR, &root);
+
+  /* Now that all sectors are allocated, fill in the free map.
+     Bits past the end of the device count as used. */
+  hdr = sector (FREE_MAP_START);
+  hdr->magic = FREE_MAP_MAGIC;
+  hdr->sector_cnt = sector_cnt;
+  hdr->group_cnt = group_cnt;
+  for (g = 0; g < group_cnt; g++)
+    {
+      uint8_t *bits = sector (FREE_MAP_START + hdr_cnt + g);
+      uint16_t free_cnt = 0;
+
+      for (i = 0; i < GROUP_BITS; i++)
+        {
+          sec = g * GROUP_BITS + i;
+          if (sec < next_free || sec >= sector_cnt)
+            bits[i / 8] |= 1 << (i % 8);
+          else
+            free_cnt++;
+        }
+      hdr->free[g] = free_cnt;
+    }
+
+  out = fopen (image, "wb");
+  if (out == NULL
+      || fwrite (disk, SECTOR_SIZE, sector_cnt, out) != sector_cnt
+      || fclose (out) != 0)
+    fail ("%s", image);
+  printf ("%s: %u of %u sectors used\n", image, next_free, sector_cnt);
+  return EXIT_SUCCESS;
+}
@@ -1,4 +1,6 @@
 #include <string.h>
+#include <debug.h>
+#include <random.h>
 
 #include "vm-util.h"
 #include "threads/palloc.h"
@@ -10,62 +12,320 @@
  *                          Frame Tables
   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
 
-/** Initialize a frame table. */
-void 
-frametb_init (struct frame_table *ftb)
+/** Protects the frame table and serializes paging. */
+struct lock frame_lock;
+
+/** One entry per page of the user pool, indexed by palloc_user_idx. */
+static struct frame *frames;
+
+/** Number of entries in frames. */
+static size_t frame_cnt;
+
+/** Number of frames in use. */
+static size_t frame_used;
+
+/** Clock hand: the next frame to consider for eviction. */
+static size_t clock_hand;
+
+/** Eviction policies, chosen with -evict at boot. */
+static const char *policy_names[] = 
+  {
+    [EVICT_ECLOCK] "eclock",
+    [EVICT_CLOCK] "clock",
+    [EVICT_RANDOM] "random",
+  };
+
+/** Policy in use. */
+static enum evict_policy policy = EVICT_ECLOCK;
+
+/** Select the eviction policy by name. Returns false if there is no
+   such policy. */
+bool
+frametb_set_policy (const char *name)
 {
-#ifdef ROBUST
-  ASSERT (ftb != NULL);
-#endif
-  memset (ftb, 0, sizeof (struct frame_table));
+  for (int i = 0; name != NULL && i < EVICT_CNT; ++i)
+    {
+      if (!strcmp (name, policy_names[i])) {
+        policy = i;
+        return true;
+      }
+    }
+  return false;
+}
+
+/** Initialize the frame table over the whole user pool. */
+void
+frametb_init (void)
+{
+  lock_init (&frame_lock);
+  frame_cnt = palloc_user_cnt ();
+  frames = calloc (frame_cnt, sizeof (struct frame));
+  if (frames == NULL)
+    PANIC ("frame table allocation failed");
+}
+
+/** Returns the frame holding kernel page kpage. */
+struct frame *
+frametb_lookup (void *kpage)
+{
+  return &frames[palloc_user_idx (pg_round_down (kpage))];
+}
+
+/** Returns the number of free frames. */
+size_t
+frametb_free_cnt (void)
+{
+  return frame_cnt - frame_used;
+}
+
+/** Give frame f to user page uaddr of the current process. The frame
+   starts pinned. Must hold frame_lock. */
+void
+frametb_claim (struct frame *f, void *uaddr)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  if (f->owner != NULL) {
+    struct process_meta *old = f->owner->meta;
+    old->frame_cnt--;
+  }
+  f->owner = thread_current ();
+  struct process_meta *meta = f->owner->meta;
+  meta->frame_cnt++;
+  f->upage = pg_round_down (uaddr);
+  f->pinned = 1;
 }
 
-/** Get a page from frame table, if not find, return NULL.
+/** Get a page from the user pool for uaddr, if none left, return NULL.
  * @param zero if set to 1, then zero out the entire allocated page.
  */
 void *
-frametb_get_page (struct frame_table *ftb, void *uaddr, int zero)
+frametb_get_page (void *uaddr, int zero)
 {
 #ifdef ROBUST
-  ASSERT (ftb != NULL);
   ASSERT (uaddr != NULL);
-  ASSERT (ftb->free_ptr >= 0 && ftb->free_ptr <= NFRAME);
 #endif
-  if (ftb->free_ptr == NFRAME) {
-    /* Cannot record more pages! */
-    return NULL;
-  }
   void *page = palloc_get_page (PAL_USER | (zero != 0 ? PAL_ZERO : 0));
   if (page != NULL) {
-    /* Record the address of the page */
-    ftb->pages[ftb->free_ptr] = page;
-    ftb->upages[ftb->free_ptr] = pg_round_down (uaddr);
-    ftb->free_ptr++;
+    struct frame *f = frametb_lookup (page);
+    frame_used++;
+    f->kpage = page;
+    frametb_claim (f, uaddr);
   }
 
-  return page; 
+  return page;
+}
+
+/** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
+ *                          Frame Quotas
+  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
+
+/** While free frames remain, any process may take them. Once the pool
+   is exhausted, a process within its quota takes frames from those
+   over theirs, and a process at its quota replaces its own pages.
+
+   The quota follows the page fault frequency, sampled every PFF_PERIOD
+   ticks: a process faulting often has a working set larger than its
+   frames and gets more, one that stopped faulting gives frames back.
+   Samples are taken when the process faults, or when its frames are
+   looked at for eviction, since the timer interrupt may not take the
+   locks needed to walk other processes. */
+
+/** Start the quota of a new process. */
+void
+frametb_quota_init (struct process_meta *meta)
+{
+  meta->frame_quota = QUOTA_MIN;
+  meta->pff_faults = 0;
+  meta->pff_start = timer_ticks ();
 }
 
-/** Free the entire frame table. */
-void 
-frametb_free (struct frame_table *ftb)
+/** Close the samples of meta that ended by now, and adjust its
+   quota. Must hold frame_lock. */
+static void
+frametb_quota_update (struct process_meta *meta)
 {
-#ifdef ROBUST
-  ASSERT (ftb != NULL);
-#endif
-  struct thread *cur = thread_current ();
-  uint32_t *pagedir = cur->pagedir;
-  struct process_meta *meta = cur->meta;
+  const int64_t now = timer_ticks ();
+  int64_t periods = (now - meta->pff_start) / PFF_PERIOD;
+  if (periods == 0)
+    return;
+
+  /* Grow by the pages the process could not keep, halve on a quiet
+     sample. Samples that ended with no fault at all are quiet too. */
+  if (meta->pff_faults > PFF_HIGH)
+    meta->frame_quota += meta->pff_faults;
+  else if (meta->pff_faults <= PFF_LOW)
+    meta->frame_quota /= 2;
+  for (; periods > 1 && meta->frame_quota > QUOTA_MIN; --periods)
+    meta->frame_quota /= 2;
+
+  if (meta->frame_quota < QUOTA_MIN)
+    meta->frame_quota = QUOTA_MIN;
+  if (meta->frame_quota > (int) frame_cnt)
+    meta->frame_quota = frame_cnt;
+  meta->pff_faults = 0;
+  meta->pff_start = now;
+}
+
+/** Count a page fault of the process meta. Must hold frame_lock. */
+void
+frametb_fault (struct process_meta *meta)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  frametb_quota_update (meta);
+  meta->pff_faults++;
+}
+
+/** Returns true if frame f may be evicted: it is in use, not pinned,
+   belongs to owner unless that is NULL, and if over_quota is set, its
+   owner holds more frames than its quota. */
+static bool
+frametb_candidate (struct frame *f, const struct thread *owner,
+                   bool over_quota)
+{
+  if (f->owner == NULL || f->pinned > 0)
+    return false;
+  if (owner != NULL && f->owner != owner)
+    return false;
+  if (over_quota) {
+    struct process_meta *meta = f->owner->meta;
+    frametb_quota_update (meta);
+    return meta->frame_cnt > meta->frame_quota;
+  }
+  return true;
+}
+
+/** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
+ *                        Eviction Policies
+  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
+
+/** CLOCK: frames whose page was accessed since the hand last passed
+   get a second chance. The first sweep clears the accessed bits it
+   meets. */
+static struct frame *
+frametb_clock (const struct thread *owner, bool over_quota)
+{
+  for (size_t n = 0; n < 2 * frame_cnt; ++n)
+    {
+      struct frame *f = &frames[clock_hand];
+      clock_hand = (clock_hand + 1) % frame_cnt;
+      if (!frametb_candidate (f, owner, over_quota))
+        continue;
+
+      uint32_t *pd = f->owner->pagedir;
+      if (pagedir_is_accessed (pd, f->upage)) {
+        pagedir_set_accessed (pd, f->upage, false);
+        continue;
+      }
+      return f;
+    }
+  return NULL;
+}
 
-  for (int i = 0; i < NFRAME; ++i)
+/** Enhanced second chance: prefer frames neither accessed nor dirty,
+   which cost no write, then those only dirty. Each round first looks
+   for a clean unreferenced frame without touching any bit, then for
+   a dirty one, clearing accessed bits on the way, so the second
+   round is sure to find a frame. */
+static struct frame *
+frametb_eclock (const struct thread *owner, bool over_quota)
+{
+  for (int round = 0; round < 2; ++round)
     {
-      if (ftb->pages[i] != NULL) {
-        palloc_free_page (ftb->pages[i]);
+      for (int want_dirty = 0; want_dirty < 2; ++want_dirty)
+        {
+          for (size_t n = 0; n < frame_cnt; ++n)
+            {
+              struct frame *f = &frames[clock_hand];
+              clock_hand = (clock_hand + 1) % frame_cnt;
+              if (!frametb_candidate (f, owner, over_quota))
+                continue;
 
-        /* Unmap the page in the pagedir */
-        if (ftb->upages[i] != NULL) {
-          pagedir_clear_page (pagedir, ftb->upages[i]);
+              uint32_t *pd = f->owner->pagedir;
+              const bool accessed = pagedir_is_accessed (pd, f->upage);
+              if (!accessed
+                  && pagedir_is_dirty (pd, f->upage) == (bool) want_dirty)
+                return f;
+              if (want_dirty && accessed)
+                pagedir_set_accessed (pd, f->upage, false);
+            }
         }
-      }
     }
+  return NULL;
+}
+
+/** Random, the policy of old, kept for comparison. */
+static struct frame *
+frametb_random (const struct thread *owner, bool over_quota)
+{
+  const size_t start = random_ulong () % frame_cnt;
+  for (size_t n = 0; n < frame_cnt; ++n)
+    {
+      struct frame *f = &frames[(start + n) % frame_cnt];
+      if (frametb_candidate (f, owner, over_quota))
+        return f;
+    }
+  return NULL;
+}
+
+/** Choose a frame to evict with the policy selected at boot. Pinned
+   frames are skipped. Must hold frame_lock.
+   @param owner if not NULL, only consider frames of this process.
+   @param over_quota only consider frames of processes over quota.
+   @return the frame, now pinned, NULL if no frame qualifies. */
+struct frame *
+frametb_victim (const struct thread *owner, bool over_quota)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  struct frame *f;
+  switch (policy)
+    {
+    case EVICT_CLOCK:
+      f = frametb_clock (owner, over_quota);
+      break;
+    case EVICT_RANDOM:
+      f = frametb_random (owner, over_quota);
+      break;
+    default:
+      f = frametb_eclock (owner, over_quota);
+      break;
+    }
+  if (f != NULL)
+    f->pinned = 1;
+  return f;
+}
+
+/** Return the page of frame f to the user pool. Must hold frame_lock. */
+void
+frametb_free_page (struct frame *f)
+{
+  ASSERT (f->owner != NULL);
+  struct process_meta *meta = f->owner->meta;
+  meta->frame_cnt--;
+  frame_used--;
+  palloc_free_page (f->kpage);
+  memset (f, 0, sizeof (struct frame));
+}
+
+/** Free all frames of process t, and unmap them in its pagedir with a
+   single TLB flush at the end. Must hold frame_lock. */
+void
+frametb_free (struct thread *t)
+{
+#ifdef ROBUST
+  ASSERT (t != NULL);
+#endif
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  for (size_t i = 0; i < frame_cnt; ++i)
+    {
+      struct frame *f = &frames[i];
+      if (f->owner != t)
+        continue;
+
+      /* Unmap the page in the pagedir */
+      ASSERT (f->pinned == 0);
+      pagedir_clear_page_lazy (t->pagedir, f->upage);
+      frametb_free_page (f);
+    }
+  pagedir_invalidate (t->pagedir, NULL, SIZE_MAX);
 }
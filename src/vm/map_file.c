@@ -6,223 +6,171 @@
  *                      Memory Mapping files
   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
 
-/**
- * @return the index into directory pages of a user virtual address.
- */
-static inline unsigned int
-mf_root_index (void *uaddr)
-{
-#ifndef ROBUST
-  return (unsigned int)(uaddr) >> 22;
-#else
-  unsigned int ret = (unsigned int)(uaddr) >> 22;
-  ASSERT (ret < 1024);
-  return ret;
-#endif // ROBUST
-}
-
 static inline void
 mf_validate (struct map_file *mf)
 {
-  ASSERT (mf->fobj != NULL && mf->read_bytes <= PGSIZE);
+  ASSERT (mf->fobj != NULL && mf->start < mf->end);
+  ASSERT (pg_ofs (mf->start) == 0 && pg_ofs (mf->end) == 0);
+  ASSERT (mf->read_bytes <= mf->end - mf->start);
 }
 
 /**
- * @return the index into map_file pointers of a user virtual address.
+ * @return the index of the first area in the table that ends after
+ * uaddr, tb->cnt if there is none.
  */
-static inline unsigned int
-mf_dir_index (void *uaddr) {
-#ifndef ROBUST
-  return ((unsigned int)(uaddr) << 10) >> 22;
-#else
-  unsigned ret = ((unsigned int)(uaddr) << 10) >> 22;
-  ASSERT (ret < 1024);
-  return ret;
-#endif // ROBUST
-}
-
-/** Retrieve a slot in the map file table. */
-struct map_file **
-map_file_walk (void *rt, void *uaddr)
+static size_t
+map_file_search (struct map_file_table *tb, const void *uaddr)
 {
-  /* At root level */
-  struct map_file_rt *mfrt = rt;
-  unsigned int idx = mf_root_index (uaddr);
-  struct map_file_dir *mfdir = mfrt->dirs[idx];
-  if (mfdir == NULL) /* Cannot walk deeper. */
-    return NULL;
-
-  /* At dir level*/
-  idx = mf_dir_index (uaddr);
-  return &(mfdir->mfs[idx]); 
+  size_t lo = 0, hi = tb->cnt;
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (tb->areas[mid]->end <= (uint8_t *) uaddr)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
 }
 
 /** Initialize the file mapping table. */
-void *
-map_file_init ()
+struct map_file_table *
+map_file_init (void)
 {
   // file map table reside in kernel space.
-  void *rt = palloc_get_page (0);
-  if (rt != NULL) {
-    memset (rt, 0, PGSIZE);
+  struct map_file_table *tb = malloc (sizeof (struct map_file_table));
+  if (tb != NULL) {
+    memset (tb, 0, sizeof (struct map_file_table));
   }
-  
-  // no directory page should be allocated for now!
-  return rt;
+
+  // no area should be allocated for now!
+  return tb;
 }
 
-/** 
- * Destroy the file mapping table. 
- * @param rt root of mapping table allocated by map_file_init().
+/**
+ * Destroy the file mapping table.
+ * @param tb mapping table allocated by map_file_init().
  */
-void 
-map_file_clear (void *rt)
+void
+map_file_clear (struct map_file_table *tb)
 {
-  if (rt == NULL) { return; }
-
-  // rt is pointer to pointer to directory pages.
-  void **dirptr = rt;
-  for (int i = 0; i < 1024; ++i) {
-    struct map_file **entries = dirptr[i]; 
-    if (entries == NULL) {
-      // empty entry
-      continue;
-    }
+  if (tb == NULL) { return; }
 
-    // walk deeper and retrive the map file info
-    struct map_file *entry;
-    for (int j = 0; j < 1024; ++j) {
-      entry = entries[j];
-      if (entry != NULL) {
-        file_close (entry->fobj);
-        free (entry);
-      }
-    }
-
-    // release the directory pages
-    palloc_free_page (dirptr[i]);
+  for (size_t i = 0; i < tb->cnt; ++i) {
+    file_close (tb->areas[i]->fobj);
+    free (tb->areas[i]);
   }
 
-  // release the root page.
-  palloc_free_page (rt);
+  // release the array and the table.
+  free (tb->areas);
+  free (tb);
 }
 
 /**
  * Lookup a file mapping in the mapping table.
- * @param rt root of the mapping table.
- * @param uaddr user virtual page(address)
+ * @param tb the mapping table.
+ * @param uaddr user virtual address
+ * @return the area containing uaddr, NULL if none.
  */
 struct map_file *
-map_file_lookup (void *rt, void *uaddr)
+map_file_lookup (struct map_file_table *tb, const void *uaddr)
 {
-  if (rt == NULL) {
+  if (tb == NULL) {
     PANIC ("map file table not initialized");
   }
-  unsigned int idx = mf_root_index (uaddr);
-
-  /** Now at root page */
-  void **dirptr = rt;
-  struct map_file **entries = dirptr[idx];
-  if (entries == NULL) {
+  size_t idx = map_file_search (tb, uaddr);
+  if (idx == tb->cnt || tb->areas[idx]->start > (uint8_t *) uaddr)
     return NULL;
-  }
+  return tb->areas[idx];
+}
+
+/** @return true if any area of tb overlaps user pages [start, end). */
+bool
+map_file_overlaps (struct map_file_table *tb, const void *start,
+                   const void *end)
+{
+  size_t idx = map_file_search (tb, start);
+  return idx < tb->cnt && tb->areas[idx]->start < (uint8_t *) end;
+}
 
-  /** Now at directory page */
-  idx = mf_dir_index (uaddr);
-  return entries[idx];
+/** @return the area created by mmap with id mapid, NULL if none. */
+struct map_file *
+map_file_find_id (struct map_file_table *tb, int mapid)
+{
+  for (size_t i = 0; i < tb->cnt; ++i)
+    {
+      if (tb->areas[i]->mmap && tb->areas[i]->mapid == mapid)
+        return tb->areas[i];
+    }
+  return NULL;
 }
 
 /**
- * Create a file mapping.
+ * Create a file mapping over the area [mf->start, mf->end).
  * @param mf struct map_file allocated by malloc.
- * @param uaddr user virtual page
- * @return false if failure, in this case will free(mf).
+ * @return false if failure, in this case will close mf->fobj and
+ * free(mf).
  */
-bool 
-map_file (void *rt, struct map_file *mf, void *uaddr)
+bool
+map_file (struct map_file_table *tb, struct map_file *mf)
 {
-  if (rt == NULL) {
+  if (tb == NULL) {
     PANIC ("map file table not initialized");
   }
-  unsigned int idx = mf_root_index (uaddr);
-
-  /** Now at root page */
-  void **dirptr = rt;
-
-  struct map_file **entries = dirptr[idx];
-  if (entries == NULL) {
-    /* page is missing, install */
-    void *pg = palloc_get_page (0);
-    if (pg == NULL) {
-      free (mf);
-      return false;
-    }
-    memset (pg, 0, PGSIZE);
-    dirptr[idx] = pg;
-    entries = dirptr[idx];
+  mf_validate (mf);
+
+  /* Evictions look areas up from other threads. */
+  lock_acquire (&frame_lock);
+  bool success = false;
+  if (map_file_overlaps (tb, mf->start, mf->end))
+    goto done;
+
+  /* Grow the array if full */
+  if (tb->cnt == tb->cap) {
+    size_t cap = tb->cap == 0 ? 8 : 2 * tb->cap;
+    struct map_file **areas = realloc (tb->areas, cap * sizeof *areas);
+    if (areas == NULL)
+      goto done;
+    tb->areas = areas;
+    tb->cap = cap;
   }
-  ASSERT (entries != NULL);
 
-  /* Now at directory level, install page */
-  idx = mf_dir_index (uaddr);
-  if (entries[idx] != NULL) {
-    /* Already installed */
+  /* Keep the array sorted */
+  size_t idx = map_file_search (tb, mf->start);
+  memmove (tb->areas + idx + 1, tb->areas + idx,
+           (tb->cnt - idx) * sizeof *tb->areas);
+  tb->areas[idx] = mf;
+  tb->cnt++;
+  success = true;
+
+done:
+  lock_release (&frame_lock);
+  if (!success) {
+    file_close (mf->fobj);
     free (mf);
-    return false;
   }
-  entries[idx] = mf;
-
-  /* Success */
-  return true;
+  return success;
 }
 
-/** Given the map file obj, fill the content of a user page. */
-int
-map_file_fill_page (struct map_file *mf, void *upage)
+/** Remove area mf from tb. The caller closes and frees it. */
+void
+map_file_remove (struct map_file_table *tb, struct map_file *mf)
 {
-  /* Validate parameter */
-  if (mf == NULL || upage == NULL) {
-    return false;
-  }
-  mf_validate (mf);
-
-  /* Allocate one kernel page */
-  void *kpage = palloc_get_page (PAL_USER);
-  if (kpage == NULL) {
-    return false;
-  }
-
-  /* Read bytes from file */
-  if (mf->read_bytes != 0)
-    {
-      int bytes = file_read_at (mf->fobj, kpage, mf->read_bytes, mf->offset);
-      if (bytes != mf->read_bytes) {
-        free (kpage);
-        return false;
-      }
-    }
-
-  /* Fill the rest to zero */
-  int zero_bytes = PGSIZE - mf->read_bytes;
-  if (zero_bytes != 0) {
-    memset (kpage + mf->read_bytes, 0, zero_bytes);
-  }
-
-  /* Create the file mapping */
-  int ret = pagedir_set_page (thread_current ()->pagedir, 
-                               upage, kpage, mf->writable);
-  if (!ret) {
-    free (kpage);
-  }
-  return ret;
+  lock_acquire (&frame_lock);
+  size_t idx = map_file_search (tb, mf->start);
+  ASSERT (idx < tb->cnt && tb->areas[idx] == mf);
+  memmove (tb->areas + idx, tb->areas + idx + 1,
+           (tb->cnt - idx - 1) * sizeof *tb->areas);
+  tb->cnt--;
+  lock_release (&frame_lock);
 }
 
 /**
- * Initialize a page using the info in the mf.
+ * Initialize user page upage of the area mf into kpage.
  * @return 1 on success, 0 if failure(device crash, etc.)
  */
-int 
-map_file_init_page (struct map_file *mf, void *kpage)
+int
+map_file_init_page (struct map_file *mf, const void *upage, void *kpage)
 {
   /* Validate parameter */
   if (mf == NULL || kpage == NULL) {
@@ -231,19 +179,21 @@ map_file_init_page (struct map_file *mf, void *kpage)
   mf_validate (mf);
 
   /* Read bytes from file */
-  if (mf->read_bytes != 0)
+  const int read_bytes = mf_page_bytes (mf, upage);
+  if (read_bytes != 0)
     {
-      int bytes = file_read_at (mf->fobj, kpage, mf->read_bytes, mf->offset);
-      if (bytes != mf->read_bytes) {
-        free (kpage);
+      int bytes = file_read_at (mf->fobj, kpage, read_bytes,
+                                mf_page_ofs (mf, upage));
+      if (bytes != read_bytes) {
+        /* The caller owns kpage and gives it back. */
         return false;
       }
     }
 
   /* Fill the rest to zero */
-  int zero_bytes = PGSIZE - mf->read_bytes;
+  int zero_bytes = PGSIZE - read_bytes;
   if (zero_bytes != 0) {
-    memset (kpage + mf->read_bytes, 0, zero_bytes);
+    memset (kpage + read_bytes, 0, zero_bytes);
   }
 
   /* Success */
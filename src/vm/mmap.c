@@ -1,4 +1,5 @@
 #include <debug.h>
+#include <round.h>
 #include "userprog/pagedir.h"
 #include "userprog/process.h"
 #include "threads/vaddr.h"
@@ -7,209 +8,109 @@
  *                       Memory Mapped File Impl 
   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
 
-/** Allocate a file map id, returns -1 if failure. */
-static int
-mapid_alloc (void)
-{
-  struct thread *cur = thread_current ();
-  struct process_meta *meta = cur->meta;
-  for (int i = 0; i < NMMAP; ++i) {
-    if (meta->mmaptb[i] == NULL) /* Success */
-      return i;
-  }
-  return -1;
-}
-
-static void *
-mapid_lookup (int md)
-{
-  if (md < 0 || md >= NMMAP)
-    return NULL;
-  struct thread *cur = thread_current ();
-  struct process_meta *meta = cur->meta;
-  return meta->mmaptb[md];
-}
+static void unmap_area (struct map_file *mf);
 
-static void
-mapid_free (int md)
-{
-  /* validate map id. */
-  ASSERT (md >= 0 && md < NMMAP);
-  struct thread *cur = thread_current ();
-  struct process_meta *meta = cur->meta;
-
-  /* Zero out the slot for future use. */
-  meta->mmaptb[md] = NULL;
-}
-
-static void unmap_from (void *map_file_rt, void *upage, 
-                        unsigned bytes, int writeback);
-
-/** Map a file object mf at address upage.
+/** Map a file object mf at address upage. The whole file becomes one
+ * area, whatever its length.
  * @return the mapping id. -1 if failure.
  */
-int 
+int
 vm_mmap (struct file *fobj, void *upage)
 {
   if (fobj == NULL || upage == NULL)
     return -1;
 
-  /* No. must be page aligned. */ 
+  /* No. must be page aligned. */
   if (pg_ofs (upage) != 0U)
     return -1;
-  
-  unsigned int left = file_length (fobj);
-  if (left == 0U) /* do not create for zero-len files. */
+
+  off_t len = file_length (fobj);
+  if (len == 0) /* do not create for zero-len files. */
+    return -1;
+
+  /* No overlap with code, data, other mapping: they are all areas.
+     Neither with the stack, which may grow down to STACK_LOW. */
+  uint8_t *end = (uint8_t *) upage + ROUND_UP (len, PGSIZE);
+  if (end > (uint8_t *) STACK_LOW || end < (uint8_t *) upage)
     return -1;
 
-  int md = mapid_alloc ();
-  /* Maximum allowed exceed */
-  if (md < 0)
+  struct map_file *mf = malloc (sizeof (struct map_file));
+  if (mf == NULL) /* Fail to allocate slot! */
     return -1;
-  ASSERT (md < NMMAP);
-  /* Record mmap */
+
+  /* initialize data members */
   struct thread *cur = thread_current ();
   struct process_meta *meta = cur->meta;
-  meta->mmaptb[md] = upage;
-
-  /* record start of mapping. */
-  void *mstart = upage;
-  /* record total bytes mapped(plus offset of a file). */
-  off_t offset = 0;
+  mf->start = upage;
+  mf->end = end;
+  mf->fobj = file_reopen (fobj);
+  mf->offset = 0;
+  mf->read_bytes = len;
+  mf->mmap = 1;
+  mf->writable = 1;
+  mf->mapid = meta->next_mapid;
+  if (mf->fobj == NULL) {
+    free (mf);
+    return -1;
+  }
 
-  /* Execute mapping. */
-  while (left > 0U)
-    {
-      if (vm_is_present (upage)) /* Overlapping detected! */
-        goto mmap_fail;
-
-      struct map_file *mf = malloc (sizeof (struct map_file));
-      if (mf == NULL) /* Fail to allocate slot! */
-        goto mmap_fail;
-
-      /* initialize data members */
-      mf->fobj = file_reopen (fobj);
-      mf->offset = offset;
-      mf->read_bytes = left >= PGSIZE ? PGSIZE : left;
-      mf->mmap = 1;
-      mf->writable = 1;
-
-      /* Install the page in the table. */
-      if (!map_file (meta->map_file_rt, mf, upage))
-        PANIC ("Should not fail map file");
-
-      /* Advance. */
-      upage += PGSIZE;
-      offset += mf->read_bytes; // offset is incremented only if a file 
-                                // mapping succeeded.
-      left -= mf->read_bytes;
-    }
+  /* Install the area in the table, fails if overlapping. */
+  if (!map_file (meta->map_file_tb, mf))
+    return -1;
 
   /* Success. */
-  return md;
-mmap_fail:
-  /* Free map id. */
-  mapid_free (md);
-  /* From start to last mapped, unmap all pages! */
-  unmap_from (meta->map_file_rt, mstart, offset, 0);
-  return -1; 
+  return meta->next_mapid++;
 }
 
-int 
+int
 vm_unmap (int md)
 {
-  void *upage = mapid_lookup (md);
-  if (upage == NULL)
-    return -1;
-
-  struct thread *cur = thread_current (); 
+  struct thread *cur = thread_current ();
   struct process_meta *meta = cur->meta;
-  struct map_file *mf = map_file_lookup (meta->map_file_rt, upage); 
-  ASSERT (mf != NULL);  /* Must not be null. */
-  off_t flen = file_length (mf->fobj);
-  unmap_from (meta->map_file_rt, upage, flen, 1);
+  struct map_file *mf = map_file_find_id (meta->map_file_tb, md);
+  if (mf == NULL)
+    return -1;
 
-  /* Free mapid */
-  meta->mmaptb[md] = NULL;
+  unmap_area (mf);
   return 0;
 }
 
-  /* No. no overlap with code, data, stack, other mapping, etc. */
-
-/** In the mapping, unmap from an address. 
- * This includes unmap in the table, close fobj, free map_file struct.
- * @param writeback if nonzero, write back [dirty] pages.
- */
-static void 
-unmap_from (void *map_file_rt, void *upage, 
-            unsigned int bytes, int writeback)
+/** Unmap all mmap areas of the current process, which is exiting. */
+void
+vm_unmap_all (void)
 {
-  /* validate parameters */
-  if (bytes == 0)
-    return;
-  struct map_file *first = map_file_lookup (map_file_rt, upage);
-  if (first == NULL) /* Not mapped at all(or fail at first alloc )*/
-    return;
-
-  /* page directory. */
   struct thread *cur = thread_current ();
-  uint32_t *pgtbl = cur->pagedir;
   struct process_meta *meta = cur->meta;
-  struct frame_table *ftb = &(meta->frametb);
-  
-  /* First mapped fobj */
-  unsigned int left = bytes;
-  off_t offset = 0;
-
-  /* Start unmapping. */
-  while (left > 0U)
+  struct map_file_table *tb = meta->map_file_tb;
+
+  for (size_t i = 0; i < tb->cnt; )
     {
-      struct map_file **mfpp = map_file_walk (map_file_rt, upage);
-
-      /* Validate return value. */
-      if (mfpp == NULL)
-        PANIC ("unmapping encounted dir page missing");
-      struct map_file *mf = *mfpp;
-      if (mf == NULL)
-        PANIC ("unmapping encounted mfobj missing");
-      if (!mf->mmap)
-        PANIC ("not mapped by mmap!");
-      /* Validate offset consistency. */
-      ASSERT (offset == mf->offset);
-      
-      /* If writeback, present and dirty, writeback. */
-      if (writeback && pagedir_is_dirty (pgtbl, upage)) {
-        /* Hint: if upage is dirty, then it must exist in memory! */
-        void *kpage = pagedir_get_page (thread_current ()->pagedir, upage);
-        if (kpage != NULL)
-          file_write_at (mf->fobj, kpage, mf->read_bytes, mf->offset);
-      }
-      
-      /* If writeback = 0, then it must be from mmap; else from munmap. */
-      if (writeback) {
-        /* If page exist, unmap from memory. */
-        pagedir_clear_page (pgtbl, upage);
-        /* Also unmap from frame table!(why?) */
-        for (int i = 0; i < NFRAME; ++i) {
-          if (ftb->upages[i] == upage)
-            ftb->upages[i] = NULL;
-        }
-      }
-
-      /* Advance. */
-      offset += mf->read_bytes;
-      ASSERT (left >= mf->read_bytes);
-      left -= mf->read_bytes;
-      upage += PGSIZE;
-
-      /* Close fobj, free mf. */
-      file_close (mf->fobj);
-      free (mf);
-      
-      /* Zero out this slot */
-      *mfpp = NULL;
+      if (tb->areas[i]->mmap)
+        unmap_area (tb->areas[i]);
+      else
+        ++i;
     }
-  /* All jobs done. */
+}
+
+/** Unmap a whole area created by mmap.
+ * This includes writing back dirty pages, unmap in the table, close
+ * fobj, free map_file struct.
+ */
+static void
+unmap_area (struct map_file *mf)
+{
+  if (!mf->mmap)
+    PANIC ("not mapped by mmap!");
+
+  /* If present, write back if dirty, then unmap from memory and give
+     the frame back. */
+  vm_free_pages (mf->start, (mf->end - mf->start) / PGSIZE, mf);
+
+  /* Close fobj, free mf. */
+  struct process_meta *meta = thread_current ()->meta;
+  map_file_remove (meta->map_file_tb, mf);
+  file_close (mf->fobj);
+  free (mf);
 }
 
 /** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
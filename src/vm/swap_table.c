@@ -4,7 +4,9 @@
 #include "lib/kernel/bitmap.h"
 #include "devices/block.h"
 #include "threads/palloc.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
+#include "userprog/pagedir.h"
 #include "vm-util.h"
 
 /** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
@@ -15,29 +17,31 @@
 static struct bitmap *swap_table_bitmap;
 
 /** Avoid concurrent access to bitmap */
-static struct lock stb_bitmap_lock __attribute__((unused));
+static struct lock stb_bitmap_lock;
 
-/** Allocate a consecutive 8 disk blocks to store a memory page,
+/** Next fit: where the search for free pages starts. */
+static size_t stb_hint;
+
+/** Allocate cnt consecutive pages (8 disk blocks each) of the swap
+   device, and return the index of the first, (unsigned)-1 if none.
    Pay attention to how to translate from page index to block no:
    page_idx * 8 => blockno.
  */
 static unsigned int
-swap_table_alloc_page (void)
+swap_table_alloc_page (size_t cnt)
 {
 #ifdef ROBUST
   // validate parameters
   ASSERT (swap_table_bitmap != NULL);
 #endif
-  for (unsigned i = 0; i < SWAP_PAGES; ++i)
-    {
-      if (!bitmap_test (swap_table_bitmap, i))
-        {
-          /* Mark the page as used */
-          bitmap_set (swap_table_bitmap, i, 1);
-          return i;
-        }
-    }
-  return (unsigned)-1;
+  lock_acquire (&stb_bitmap_lock);
+  size_t idx = bitmap_scan_and_flip (swap_table_bitmap, stb_hint, cnt, 0);
+  if (idx == BITMAP_ERROR)
+    idx = bitmap_scan_and_flip (swap_table_bitmap, 0, cnt, 0);
+  if (idx != BITMAP_ERROR)
+    stb_hint = (idx + cnt) % SWAP_PAGES;
+  lock_release (&stb_bitmap_lock);
+  return idx == BITMAP_ERROR ? (unsigned)-1 : idx;
 }
 
 /** Free a consecutive 8 disk blocks to store a memory page,
@@ -55,118 +59,12 @@ swap_table_free_page (unsigned int page_idx)
   ASSERT (bitmap_test (swap_table_bitmap, page_idx));
 #endif
   // free the bit in the map
+  lock_acquire (&stb_bitmap_lock);
   bitmap_set (swap_table_bitmap, page_idx, 0);
+  lock_release (&stb_bitmap_lock);
   return 0;
 }
 
-/**
- * Allocate an swap table entry. Panic if cannot allocate.
- */
-static inline unsigned int
-swap_table_alloc_ste (void)
-{
-  unsigned int ret = swap_table_alloc_page ();
-  /* Add the valid bit */
-  return ret | STE_V;
-}
-
-/** Free a swap table entry. This is called by swaptb_free. */
-static inline void
-swap_table_free_ste (unsigned int ste)
-{
-#ifdef ROBUST
-  ASSERT ((ste & STE_V) != 0);
-#endif
-  swap_table_free_page (ste >> 0x3U);
-}
-
-/* Free a swap table directory page. */
-static void
-swaptb_free_dir (struct swap_table_dir *dir)
-{
-#ifdef ROBUST
-  ASSERT (dir != NULL);
-#endif
-  unsigned int entry;
-  for (int i = 0; i < 1024; ++i)
-    {
-      /* Get entry */
-      entry = dir->entries[i];
-      if ((entry & STE_V) != 0)
-        {
-          swap_table_free_ste (entry);
-        }
-    }
-
-  /* Free the page occupied by dir */ 
-  palloc_free_page ((void *) dir);
-}
-
-/** Returns the root index  */
-static inline unsigned int
-swaptb_root_idx (void *uaddr)
-{
-#ifndef ROBUST
-  return ((unsigned int) uaddr) >> 22U;
-#else
-  unsigned ret = ((unsigned int) uaddr) >> 22U;
-  ASSERT (ret < 1024U);
-  return ret;
-#endif
-}
-/** Returns the directory index */
-static inline unsigned int
-swaptb_dir_idx (void *uaddr)
-{
-#ifndef ROBUST
-  return (((unsigned int) uaddr) << 10U) >> 22U;
-#else
-  unsigned ret = (((unsigned int) uaddr) << 10U) >> 22U;
-  ASSERT (ret < 1024U);
-  return ret;
-#endif
-}
-
-/** 
- * Walk down the swap table for an entry.
- * @param alloc set to 0 if only lookup, set to 1 if allocate entry.
- */
-static unsigned int *
-swaptb_walk (struct swap_table_root *rt, void *uaddr, int alloc)
-{
-#ifdef ROBUST
-  ASSERT (rt != NULL);
-#endif
-  struct swap_table_dir *dir;
-  unsigned int idx;
-
-  /* Now at root page */
-  idx = swaptb_root_idx (uaddr);
-  dir = rt->dirs[idx];
-
-  /* directory page not found */
-  if (dir == NULL)
-    {
-      if (alloc) {
-        /* Try to install page! */
-        void *page = palloc_get_page (0);
-        if (page == NULL)
-          return NULL;
-        memset (page, 0, PGSIZE);
-        rt->dirs[idx] = page;
-      } else {
-        /* Not found */
-        return NULL;
-      }
-    }
-  dir = rt->dirs[idx];
-  ASSERT (dir != NULL);
-
-  /* Now at directory page */
-  idx = swaptb_dir_idx (uaddr);
-  return &(dir->entries[idx]);
-}
-
 /** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
  *                          Swap Tables Method
   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
@@ -175,14 +73,26 @@ unsigned int
 swaptb_alloc_sec (void)
 {
 #ifdef ROBUST
-  unsigned int sec = swap_table_alloc_page (); 
+  unsigned int sec = swap_table_alloc_page (1); 
   ASSERT (sec < SWAP_PAGES);
   return sec * 8;
 #else
-  return 8U * swap_table_alloc_page ();
+  return 8U * swap_table_alloc_page (1);
 #endif
 }
 
+/** Allocate swap slots for cnt pages in a row, and store the first
+   sector into *sec. Returns false if there is no such run. */
+bool
+swaptb_alloc_run (size_t cnt, unsigned int *sec)
+{
+  unsigned int idx = swap_table_alloc_page (cnt);
+  if (idx == (unsigned)-1)
+    return false;
+  *sec = idx * 8U;
+  return true;
+}
+
 void 
 swaptb_free_sec (unsigned int sec)
 {
@@ -202,13 +112,8 @@ vm_init (void)
   /* Validate macro SECTORS_PER_PAGE */
   STATIC_ASSERT (PGSIZE == (SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE));
 
-  /* Test the size of swap table root and directory */
-  STATIC_ASSERT (sizeof (struct swap_table_root) == PGSIZE);
-  STATIC_ASSERT (sizeof (struct swap_table_dir) == PGSIZE);
-
-  /* Test the size of map file root and directory page */
-  STATIC_ASSERT (sizeof (struct map_file_rt) == PGSIZE);
-  STATIC_ASSERT (sizeof (struct map_file_dir) == PGSIZE);
+  /* A swap slot index must fit in the address bits of a PTE */
+  STATIC_ASSERT (SWAP_PAGES <= (PTE_ADDR >> PGBITS) + 1);
 #endif
 
   /* Create a bitmap that supports a swap disk 
@@ -223,108 +128,94 @@ vm_init (void)
     }
   
   lock_init (&stb_bitmap_lock);
-}
-
-/** Return an initialized swap table, NULL if failure */
-struct swap_table_root *
-swaptb_create (void)
-{
-  void *page = palloc_get_page (0);
-  if (page != NULL) {
-    memset (page, 0, PGSIZE);
-  }
 
-  return page;
+  /* One frame table for the whole user pool. */
+  frametb_init ();
+  vm_reclaim_init ();
 }
 
-/** Free the space of a swap table and remove reference in the device. */
+/** Free the swap slots of all pages of pagedir pd that are in swap.
+   The pagedir itself is left to pagedir_destroy. */
 void 
-swaptb_free (struct swap_table_root *rt)
+swaptb_free (uint32_t *pd)
 {
 #ifdef ROBUST
   /* Validate parameters */
-  ASSERT (rt != NULL);
+  ASSERT (pd != NULL);
 #endif
-  struct swap_table_dir *dir;
-
-  for (int i = 0; i < 1024; ++i)
+  for (uint32_t *pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
     {
-      /* Get directory page */
-      dir = rt->dirs[i];
-      if (dir == NULL) {
+      /* Get page table */
+      if ((*pde & PTE_P) == 0) {
         continue;
       }
+      uint32_t *pt = pde_get_pt (*pde);
 
-      /* Free the directory. */
-      swaptb_free_dir (dir);
+      /* Free the slots it holds. */
+      for (uint32_t *pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+        {
+          if (ste_is_swap (*pte)) {
+            swaptb_free_sec (ste_get_blockno (*pte));
+            *pte = 0x0;
+          }
+        }
     }
-  
-  /* Free the root page. */
-  palloc_free_page (rt);
 }
 
-/** Given an user address, look up the swap table entry. */
-unsigned int *
-swaptb_lookup (struct swap_table_root *rt, void *uaddr)
+/** Given an user address, look up the PTE holding its swap slot.
+   Returns NULL if the page is not in swap. */
+uint32_t *
+swaptb_lookup (uint32_t *pd, void *uaddr)
 {
-  return swaptb_walk (rt, uaddr, 0);
+  uint32_t *pte = pagedir_lookup (pd, uaddr);
+  if (pte == NULL || !ste_is_swap (*pte))
+    return NULL;
+  return pte;
 }
 
-/** Returns 1 if maps successfully, 
-   0 if cannot allocate pages or mapping already exists. */
+/** Record that user page uaddr, not present, is in the swap slot at
+   sector blk. Returns 1 if maps successfully, 0 if the page was never
+   mapped or already is in swap. */
 int 
-swaptb_map (struct swap_table_root *rt, void *uaddr, unsigned int blk)
+swaptb_map (uint32_t *pd, void *uaddr, unsigned int blk)
 {
-  unsigned int *ste = swaptb_walk (rt, uaddr, 1);
-#ifdef ROBUST
-  if (ste == NULL)
-    {
-      /* Report kernel page loss */
-      PANIC ("Kernel outof memory!!!");
-    }
-  if ((*ste & STE_V) != 0)
-    {
-      return 0;
-    }
-#else
-  if (ste == NULL || (*ste & STE_V) != 0)
+  uint32_t *pte = pagedir_lookup (pd, uaddr);
+  if (pte == NULL || (*pte & PTE_P) != 0 || ste_is_swap (*pte))
     {
       return 0;
     }
-#endif  /**< ROBUST */
   ASSERT ((blk & 0X7) == 0);
-  *ste = STE_V | blk; 
+  *pte = ((blk / SECTORS_PER_PAGE) << PGBITS) | PTE_SWAP;
   return 1;
 }
 
 /** Returns 1 if unmap is successful, 0 if the mapping does not exist
    at user virtual address uaddr. */
 int 
-swaptb_unmap (struct swap_table_root *rt, void *uaddr)
+swaptb_unmap (uint32_t *pd, void *uaddr)
 {
-  unsigned int *ste = swaptb_walk (rt, uaddr, 0);
-  if (ste == NULL || (*ste & STE_V) == 0)
+  uint32_t *pte = swaptb_lookup (pd, uaddr);
+  if (pte == NULL)
     {
       return 0;
     }
-  *ste = 0x0;
+  *pte = 0x0;
   return 1;
 }
 
 /** returns the number of pages that resides in swap device. */
 unsigned int 
-swaptb_count (struct swap_table_root *rt)
+swaptb_count (uint32_t *pd)
 {
   unsigned int ret = 0;
 
-  struct swap_table_dir *dir;
-  for (int i = 0; i < 1024; ++i)
+  for (uint32_t *pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
     {
-      dir = rt->dirs[i];
-      if (dir == NULL)
+      if ((*pde & PTE_P) == 0)
         continue;
-      for (int j = 0; j < 1024; ++j)
-        if (dir->entries[j] & STE_V)
+      uint32_t *pt = pde_get_pt (*pde);
+      for (uint32_t *pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+        if (ste_is_swap (*pte))
           ret += 1;
     }
 
@@ -5,8 +5,11 @@
 #include "filesys/file.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #include "userprog/mode.h"
 
 /** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
@@ -22,41 +25,73 @@
 /** A memory page equals to 8 disk sectors */
 #define SECTORS_PER_PAGE 8
 
+/**< Frames a process keeps under memory pressure, however idle */
+#define QUOTA_MIN 16
+
+/**< Ticks in one page-fault-frequency sample */
+#define PFF_PERIOD (TIMER_FREQ / 10)
+
+/**< More faults than this in a sample grow the quota */
+#define PFF_HIGH 4
+
+/**< No more faults than this in a sample shrink the quota */
+#define PFF_LOW 0
+
+/**< Free frames below which the page-out thread starts evicting */
+#define RECLAIM_LOW 8
+
+/**< Free frames at which the page-out thread stops */
+#define RECLAIM_HIGH 24
+
+/**< Most pages the page-out thread writes to swap in one transfer */
+#define SWAP_BATCH 16
+
+/**< Most pages read from swap on one fault */
+#define SWAP_READAHEAD 8
+
+/**< Pages in the window loaded around a fault on a file page */
+#define FAULT_AROUND 8
+
 /** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
  *                       Virtual Memory Utility 
   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
 
+struct map_file;
+struct process_meta;
+
 void vm_init (void);
 void *vm_alloc_page (int zero, void *uaddr);
+bool vm_install_page (void *upage, void *kpage, bool writable);
 void *vm_fetch_page (void *upage);
 int vm_is_present (void *upage);
+void *vm_pin (uint32_t *pd, void *upage, int write);
+void vm_unpin (void *kaddr);
+void vm_free_pages (void *upage, size_t cnt, struct map_file *mf);
+void vm_exit (void);
+void vm_reclaim_init (void);
 
 /** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
  *                         Data Structures 
   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
 
-/**< Entry of supplemental page table. The members it contains
-   allow for easy lookup from user page(address) to the corresponding
-   files.
-
-   The map_file table is organized the same way as the page table; it has
-   a root page and several directory pages:
-   +----------+---------------+--------------+
-   | root idx | directory idx | map_file ptr |
-   +----------+---------------+--------------+
-   ^32        ^22             ^12            ^0
+/**< Entry of supplemental page table: an area of user pages backed by
+   one file, the segment of an executable or an mmap. Page i of the
+   area holds the bytes of the file from offset + i * PGSIZE, up to
+   read_bytes in all for the area; the rest is zero.
 
    Note that a map_file struct must be allocated by malloc, so there will
    exist a safe way to free the mapping table.
   */
 struct map_file 
   {
+    uint8_t *start;     /**< first user page */
+    uint8_t *end;       /**< past the last user page */
     struct file *fobj;  /**< file object to map, must be safe to close */
-    off_t offset;       /**< offset */
-    int read_bytes;     /**< read some bytes, the rest set to 0 */
+    off_t offset;       /**< offset of start in the file */
+    off_t read_bytes;   /**< read some bytes, the rest set to 0 */
     short writable;       /**< is the mapped file read-only? */
     short mmap;           /**< 1 if created via syscall mmap */
-    /**< see examples below! */
+    int mapid;            /**< mmap id, if mmap */
   };
 
 /** return true if a mf is created via mmap */
@@ -68,56 +103,59 @@ static inline int mf_is_writable (struct map_file *mf) {
   return (int)mf->writable;
 }
 
-/**< directory page of map file table(not used) */
-struct map_file_dir
-  {
-    struct map_file      *mfs[1024];
-  };
-
-/**< root page of map file table(not used) */
-struct map_file_rt
-  {
-    struct map_file_dir  *dirs[1024];
-  };
+/** return the offset in the file of user page upage of mf */
+static inline off_t
+mf_page_ofs (const struct map_file *mf, const void *upage)
+{
+  return mf->offset + ((uint8_t *) pg_round_down (upage) - mf->start);
+}
 
+/** return the bytes of user page upage read from the file, the rest
+   of the page is zero */
+static inline int
+mf_page_bytes (const struct map_file *mf, const void *upage)
+{
+  const off_t left = mf->read_bytes
+                     - ((uint8_t *) pg_round_down (upage) - mf->start);
+  return left <= 0 ? 0 : left < PGSIZE ? left : PGSIZE;
+}
 
-/**< Frame table. */
-struct frame_table
+/**< File mapping table of a process: pointers to its areas, sorted
+   by start, so that looking up an address is a binary search. */
+struct map_file_table
   {
-    void      *pages[NFRAME];    /**< number of private frames(pages) */
-    void      *upages[NFRAME];   /**< record user page mappings */
-    int        free_ptr;         /**< index to the next uninitialized frame */
+    struct map_file **areas;    /**< Areas, sorted by start */
+    size_t cnt;                 /**< Areas in use */
+    size_t cap;                 /**< Capacity of areas */
   };
 
-/**< Directory page of swap table */
-struct swap_table_dir
-  {
-    /** Layout of swap table entry
-      +----------------+----------+
-      |  block number  | aux bits |
-      +----------------+----------+
-      ^32              ^3         ^0
-     */
-    unsigned int     entries[1024];  /**< Entries(i.e. number of block ids) */
-  };
 
-/**< Root of swap table. */
-struct swap_table_root
+/**< Frame table entry, one for each page of the user pool. The table
+   is shared by all processes, each entry maps back to the process and
+   user page that use the frame. */
+struct frame
   {
-    struct swap_table_dir  *dirs[1024];  /**< Pointer to directories */
+    struct thread *owner;        /**< Owning process, NULL if free */
+    void      *upage;            /**< User page mapped to the frame */
+    void      *kpage;            /**< Kernel address of the frame */
+    int        pinned;           /**< >0: must not be evicted */
   };
 
 /** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
  *                      Memory Mapping files
   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
 
-struct map_file *map_file_lookup (void *rt, void *uaddr);
-struct map_file **map_file_walk (void *rt, void *uaddr);
-bool map_file (void *rt, struct map_file *mf, void *uaddr);
-void *map_file_init (void);
-void map_file_clear (void *);
-int map_file_fill_page (struct map_file *mf, void *upage);
-int map_file_init_page (struct map_file *mf, void *kpage);
+struct map_file *map_file_lookup (struct map_file_table *tb,
+                                  const void *uaddr);
+bool map_file_overlaps (struct map_file_table *tb, const void *start,
+                        const void *end);
+struct map_file *map_file_find_id (struct map_file_table *tb, int mapid);
+bool map_file (struct map_file_table *tb, struct map_file *mf);
+void map_file_remove (struct map_file_table *tb, struct map_file *mf);
+struct map_file_table *map_file_init (void);
+void map_file_clear (struct map_file_table *);
+int map_file_init_page (struct map_file *mf, const void *upage,
+                        void *kpage);
 
 /** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
  *                       Memory Mapped File Impl 
@@ -125,66 +163,128 @@ int map_file_init_page (struct map_file *mf, void *kpage);
 
 int vm_mmap (struct file *fobj, void *upage);
 int vm_unmap (int md);
+void vm_unmap_all (void);
 
 /** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
  *                          Swap Tables
   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
 
-/**< To validate an entry, use: (STE_V & entry) */
-#define STE_V 0x1
+/**< The swap table lives in the page tables: the PTE of a page that is
+   in swap is not present, and holds the index of its swap slot in the
+   address bits, tagged with PTE_SWAP, one of the bits the CPU leaves
+   to the OS.
+   +-----------------+-----+-----------+---+
+   |  swap slot idx  | SWP |     0     | P |
+   +-----------------+-----+-----------+---+
+   ^32               ^12   ^9          ^1  ^0
+  */
+#define PTE_SWAP 0x200
+
+/** Returns true if the PTE pte holds a swap slot. */
+static inline bool
+ste_is_swap (uint32_t pte)
+{
+  return (pte & (PTE_P | PTE_SWAP)) == PTE_SWAP;
+}
 
 /** Given an swap table entry, return the block number. */
 static inline unsigned int
-ste_get_blockno (unsigned int ste)
+ste_get_blockno (uint32_t ste)
 {
   /* A primary benefit of doing so, is that 
     memory_page_size = 8 * disk_block_size. */
-  return ste & (~0x00000007);
+  return (ste >> PGBITS) * SECTORS_PER_PAGE;
 }
 
 /** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
  *                          Frame Tables
   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
 
-void frametb_init (struct frame_table *ftb);
-void *frametb_get_page (struct frame_table *ftb, void *uaddr, int zero);
-void frametb_free (struct frame_table *ftb);
+extern struct lock frame_lock;
+
+/**< Ways to choose the frame to evict. */
+enum evict_policy
+  {
+    EVICT_ECLOCK,       /**< Enhanced second chance (default) */
+    EVICT_CLOCK,        /**< Second chance on the accessed bit */
+    EVICT_RANDOM,       /**< Any unpinned frame */
+    EVICT_CNT
+  };
+
+bool frametb_set_policy (const char *name);
+void frametb_init (void);
+struct frame *frametb_lookup (void *kpage);
+void frametb_claim (struct frame *f, void *uaddr);
+size_t frametb_free_cnt (void);
+void *frametb_get_page (void *uaddr, int zero);
+struct frame *frametb_victim (const struct thread *owner, bool over_quota);
+void frametb_quota_init (struct process_meta *meta);
+void frametb_fault (struct process_meta *meta);
+void frametb_free_page (struct frame *f);
+void frametb_free (struct thread *t);
 
 /**< These methods controls allocating/freeing 8 consecutive sectors. */
 
 unsigned int swaptb_alloc_sec (void);
+bool swaptb_alloc_run (size_t cnt, unsigned int *sec);
 void swaptb_free_sec (unsigned int sec);
 
 /**< These methods operate on swap tables. */
 
-struct swap_table_root *swaptb_create (void);
-void swaptb_free (struct swap_table_root *rt);
-unsigned int *swaptb_lookup (struct swap_table_root *rt, void *uaddr);
-int swaptb_map (struct swap_table_root *rt, void *uaddr, unsigned int blk);
-int swaptb_unmap (struct swap_table_root *rt, void *uaddr);
-unsigned int swaptb_count (struct swap_table_root *rt);
+void swaptb_free (uint32_t *pd);
+uint32_t *swaptb_lookup (uint32_t *pd, void *uaddr);
+int swaptb_map (uint32_t *pd, void *uaddr, unsigned int blk);
+int swaptb_unmap (uint32_t *pd, void *uaddr);
+unsigned int swaptb_count (uint32_t *pd);
 
 /** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
  *                        Block Swap Device IO
   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
 #include "devices/block.h"
 
+/**
+ * Read cnt memory pages from consecutive swap slots, in one transfer.
+ * @param sector start of the 8 * cnt sectors to read.
+ */
+static inline void
+swaptb_read_pages (unsigned int sector, void *const pages[], size_t cnt)
+{
+  ASSERT ((sector & 0x7) == 0);
+  ASSERT (cnt <= SWAP_READAHEAD);
+  void *bufs[SWAP_READAHEAD * SECTORS_PER_PAGE];
+  for (size_t i = 0; i < cnt * SECTORS_PER_PAGE; ++i)
+    bufs[i] = pages[i / SECTORS_PER_PAGE]
+              + (i % SECTORS_PER_PAGE) * BLOCK_SECTOR_SIZE;
+  block_read_multi (block_get_role (BLOCK_SWAP), sector,
+                    cnt * SECTORS_PER_PAGE, bufs);
+}
+
 /**
  * Read a memory page (8 sectors) from disk.
  * @param sector start of 8 sectors to read. 
  */
 static inline void
 swaptb_read_page (unsigned int sector, void *page)
+{
+  void *pages[1] = { page };
+  swaptb_read_pages (sector, pages, 1);
+}
+
+/**
+ * Write cnt memory pages into consecutive swap slots, in one transfer.
+ * @param sector start of the 8 * cnt sectors to write.
+ */
+static inline void
+swaptb_write_pages (unsigned int sector, void *const pages[], size_t cnt)
 {
   ASSERT ((sector & 0x7) == 0);
-  struct block *blk = block_get_role (BLOCK_SWAP);
-  for (int i = 0; i < SECTORS_PER_PAGE; ++i)
-    {
-      block_read (blk, sector + i, page);
-
-      /* Advance */
-      page += BLOCK_SECTOR_SIZE;
-    }
+  ASSERT (cnt <= SWAP_BATCH);
+  void *bufs[SWAP_BATCH * SECTORS_PER_PAGE];
+  for (size_t i = 0; i < cnt * SECTORS_PER_PAGE; ++i)
+    bufs[i] = pages[i / SECTORS_PER_PAGE]
+              + (i % SECTORS_PER_PAGE) * BLOCK_SECTOR_SIZE;
+  block_write_multi (block_get_role (BLOCK_SWAP), sector,
+                     cnt * SECTORS_PER_PAGE, bufs);
 }
 
 /**
@@ -194,16 +294,9 @@ swaptb_read_page (unsigned int sector, void *page)
 static inline void
 swaptb_write_page (unsigned int sector, const void *page)
 {
-  ASSERT ((sector & 0x7) == 0);
-  struct block *blk = block_get_role (BLOCK_SWAP);
   /* Remember, a memory page equals 8 disk blocks */
-  for (int i = 0; i < SECTORS_PER_PAGE; ++i)
-    {
-      block_write (blk, sector + i, page);
-
-      /* Advance */
-      page += BLOCK_SECTOR_SIZE;
-    }
+  void *pages[1] = { (void *) page };
+  swaptb_write_pages (sector, pages, 1);
 }
 
 #endif /**< vm/vm-util.h */
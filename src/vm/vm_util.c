@@ -1,7 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <random.h>
 #include <string.h>
+#include <round.h>
 
 #include "threads/pte.h"
 #include "threads/vaddr.h"
@@ -15,107 +15,456 @@
  *                       Virtual Memory Utility 
   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
 
-/** Evict a slot from frame table. */
-static unsigned int 
-vm_evict (struct thread *cur)
+/**< Where an evicted page must be written. */
+enum page_out_kind
+  {
+    PAGE_OUT_NONE,      /**< Nowhere, it can be loaded again as is */
+    PAGE_OUT_FILE,      /**< Back to its memory mapped file */
+    PAGE_OUT_SWAP,      /**< To a swap slot */
+  };
+
+/**< Write pending for an evicted page. */
+struct page_out
+  {
+    enum page_out_kind kind;
+    struct frame *f;            /**< Frame holding the page */
+    struct map_file *mf;        /**< Mapping, for PAGE_OUT_FILE */
+    unsigned int sector;        /**< Swap slot, for PAGE_OUT_SWAP */
+  };
+
+/** Frames of the batch the page-out thread is writing with frame_lock
+   released. Pages needing no write are listed too: they stay pinned
+   and owned until the batch is done, so their owner must not free
+   them meanwhile. */
+static struct frame *writeback[SWAP_BATCH];
+static size_t writeback_cnt;
+
+/** Signaled when writeback is done. */
+static struct condition writeback_done;
+
+/** Returns true if the page-out thread is writing a page of process
+   t, or page upage of it if that is not NULL. Must hold frame_lock. */
+static bool
+vm_writeback_busy (const struct thread *t, const void *upage)
 {
-  /* Fetch vm members */
-  struct process_meta *meta = cur->meta;
-  struct frame_table *ftb = &meta->frametb;
-  struct swap_table_root *stb = meta->swaptb;
-  uint32_t *pgtbl = cur->pagedir;
+  for (size_t i = 0; i < writeback_cnt; ++i)
+    {
+      if (writeback[i]->owner == t
+          && (upage == NULL || writeback[i]->upage == pg_round_down (upage)))
+        return true;
+    }
+  return false;
+}
 
-  /* Use random eviction policy. */
-  if (ftb->free_ptr <= 1)
-    PANIC ("user pool out of page");
-  unsigned int slot;
-select:  /* Pin the page on top of stack(i.e. don't evict it) */
-  slot = random_ulong () % (unsigned)ftb->free_ptr;
-  if (slot == 0U)
-    goto select;
-  ASSERT (slot < (unsigned)ftb->free_ptr);
-  void *uaddr = ftb->upages[slot];
+/** Wait until the page-out thread is not writing a page of process t,
+   or only page upage of it if that is not NULL. Must hold frame_lock. */
+static void
+vm_writeback_wait (const struct thread *t, const void *upage)
+{
+  while (vm_writeback_busy (t, upage))
+    cond_wait (&writeback_done, &frame_lock);
+}
+
+/** Unmap the page in frame f, pinned, from its owner and fill po with
+   what must be written to save it. A page going to swap has no slot
+   yet, see vm_swap_assign. Must hold frame_lock. */
+static void
+vm_evict_unmap (struct frame *f, struct page_out *po)
+{
+  po->kind = PAGE_OUT_NONE;
+  po->f = f;
+
+  /* Fetch vm members of the owner */
+  struct process_meta *meta = f->owner->meta;
+  uint32_t *pgtbl = f->owner->pagedir;
+  void *uaddr = f->upage;
+
+  /* Unmap the page before writing it out, so that the owner faults
+     (and waits on frame_lock) rather than changing it meanwhile. The
+     dirty bit must be read in the same breath. */
+  enum intr_level old_level = intr_disable ();
+  const bool dirty = pagedir_is_dirty (pgtbl, uaddr);
+  const int writable = pagedir_is_writable (pgtbl, uaddr);
+  pagedir_clear_page (pgtbl, uaddr);
+  intr_set_level (old_level);
 
   /* If uaddr is memory mapped page(and it is dirty), write to 
      original file directly. Then it can be reloaded from disk
      if necessary, and disk is updated as file is updated in 
      memory. */
-  struct map_file *mf = map_file_lookup (meta->map_file_rt, uaddr);
-  if (uaddr == NULL)
-    ASSERT (mf == NULL);
+  struct map_file *mf = map_file_lookup (meta->map_file_tb, uaddr);
   if (mf != NULL && mf->mmap) {
-    if (pagedir_is_dirty (cur->pagedir, uaddr)) {
+    if (dirty) {
       /* Write to original file. */
-      file_write_at (mf->fobj, uaddr, mf->read_bytes, mf->offset);
+      po->kind = PAGE_OUT_FILE;
+      po->mf = mf;
     }
-    goto evict_end;
+    return;
   }
 
-  /* Check the dirty bit of the old page, and write to somewhere */
-  if (pagedir_is_writable (cur->pagedir, uaddr))
+  /* A clean page that came from a file can be loaded again from the
+     file mapping table; anything else writable goes to swap. */
+  if (writable && (dirty || mf == NULL))
+    po->kind = PAGE_OUT_SWAP;
+}
+
+/** Give the page of po the swap slot at sector, and record it in the
+   swap table of the owner. Must hold frame_lock. */
+static void
+vm_swap_assign (struct page_out *po, unsigned int sector)
+{
+  if (!swaptb_map (po->f->owner->pagedir, po->f->upage, sector))
+    PANIC ("Should not fail swap table mapping: at %p", po->f->upage);
+  po->sector = sector;
+}
+
+/** Orders page_outs by kind, owner and user page, for sort. */
+static int
+page_out_cmp (const void *a_, const void *b_, void *aux UNUSED)
+{
+  const struct page_out *a = a_;
+  const struct page_out *b = b_;
+  if (a->kind != b->kind)
+    return a->kind < b->kind ? -1 : 1;
+  if (a->f->owner != b->f->owner)
+    return a->f->owner < b->f->owner ? -1 : 1;
+  return a->f->upage < b->f->upage ? -1 : a->f->upage > b->f->upage;
+}
+
+/** Give swap slots to the pages of po[0..cnt) going to swap, of
+   which there are swap_cnt, in one run if possible. po is sorted so
+   that neighbouring pages of a process get neighbouring slots, which
+   swap-in reads ahead. Must hold frame_lock. */
+static void
+vm_swap_assign_batch (struct page_out po[], size_t cnt, size_t swap_cnt)
+{
+  unsigned int sector;
+
+  sort (po, cnt, sizeof *po, page_out_cmp, NULL);
+  const bool run = swap_cnt > 1 && swaptb_alloc_run (swap_cnt, &sector);
+  for (size_t i = 0; i < cnt; ++i)
     {
-      /* Write to swap device, first find 8 sectors */
-      unsigned int sector = swaptb_alloc_sec ();
+      if (po[i].kind != PAGE_OUT_SWAP)
+        continue;
+      if (run) {
+        vm_swap_assign (&po[i], sector);
+        sector += SECTORS_PER_PAGE;
+      } else {
+        vm_swap_assign (&po[i], swaptb_alloc_sec ());
+      }
+    }
+}
 
-      /* Create mapping in the swap table */
-      if (!swaptb_map (stb, uaddr, sector))
-        PANIC ("Should not fail swap table mapping: at %p", uaddr);
+/** Do the writes of po[0..cnt). Pages going to consecutive swap slots
+   are written in one transfer. Needs frame_lock, or the frames marked
+   as in writeback. */
+static void
+vm_page_out (const struct page_out po[], size_t cnt)
+{
+  void *pages[SWAP_BATCH];
+  size_t i, run;
 
-      /* Write to disk, done. */ 
-      swaptb_write_page (sector, ftb->pages[slot]);
+  ASSERT (cnt <= SWAP_BATCH);
+  for (i = 0; i < cnt; i += run)
+    {
+      run = 1;
+      switch (po[i].kind)
+        {
+        case PAGE_OUT_FILE:
+          file_write_at (po[i].mf->fobj, po[i].f->kpage,
+                         mf_page_bytes (po[i].mf, po[i].f->upage),
+                         mf_page_ofs (po[i].mf, po[i].f->upage));
+          break;
+        case PAGE_OUT_SWAP:
+          pages[0] = po[i].f->kpage;
+          while (i + run < cnt && po[i + run].kind == PAGE_OUT_SWAP
+                 && po[i + run].sector
+                    == po[i].sector + run * SECTORS_PER_PAGE)
+            {
+              pages[run] = po[i + run].f->kpage;
+              run++;
+            }
+          swaptb_write_pages (po[i].sector, pages, run);
+          break;
+        default:
+          break;
+        }
     }
-  else
+}
+
+/** Evict the page in a frame chosen by the eviction policy, and return
+   the frame (still pinned). The frame belongs to owner unless it is
+   NULL, and to a process over its quota if over_quota is set. Must
+   hold frame_lock.
+   @return NULL if no frame qualifies. */
+static struct frame *
+vm_evict (const struct thread *owner, bool over_quota)
+{
+  struct frame *f = frametb_victim (owner, over_quota);
+  if (f == NULL)
+    return NULL;
+
+  struct page_out po;
+  vm_evict_unmap (f, &po);
+  if (po.kind == PAGE_OUT_SWAP)
+    vm_swap_assign (&po, swaptb_alloc_sec ());
+  vm_page_out (&po, 1);
+  return f;
+}
+
+/** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
+ *                         Page-out Thread
+  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
+
+/** The page-out thread keeps free frames in the user pool, so that a
+   fault seldom has to write a page before it can read its own. It
+   wakes up when fewer than reclaim_low frames are free and evicts
+   pages until reclaim_high are, SWAP_BATCH at a time: the pages that
+   go to swap get a run of slots and are written in one transfer.
+   Writes are done with frame_lock released, so faults go on
+   meanwhile; a process touching a page in writeback waits for it. */
+
+static size_t reclaim_low;            /**< Wake up below this. */
+static size_t reclaim_high;           /**< Stop at this. */
+static struct condition reclaim_work; /**< Free frames ran low. */
+
+/** Evict up to want pages, at most SWAP_BATCH, to the free pool.
+   Must hold frame_lock, which is released during the writes.
+   @return false if every frame is pinned. */
+static bool
+vm_reclaim_batch (size_t want)
+{
+  struct page_out po[SWAP_BATCH];
+  size_t cnt = 0, swap_cnt = 0, io_cnt = 0;
+
+  if (want > SWAP_BATCH)
+    want = SWAP_BATCH;
+  while (cnt < want)
     {
-      /* Ignore(can be load again from file mapping table )*/
+      struct frame *f = frametb_victim (NULL, true);
+      if (f == NULL)
+        f = frametb_victim (NULL, false);
+      if (f == NULL)
+        break;
+      vm_evict_unmap (f, &po[cnt]);
+      if (po[cnt].kind == PAGE_OUT_SWAP)
+        swap_cnt++;
+      if (po[cnt].kind != PAGE_OUT_NONE)
+        io_cnt++;
+      writeback[cnt++] = f;
     }
+  if (cnt == 0)
+    return false;
 
-evict_end:
-  /* Clear the mapping in page directory(Why?). */
-  pagedir_clear_page (pgtbl, uaddr);
+  if (io_cnt > 0) {
+    vm_swap_assign_batch (po, cnt, swap_cnt);
+    writeback_cnt = cnt;
+    lock_release (&frame_lock);
+    vm_page_out (po, cnt);
+    lock_acquire (&frame_lock);
+    writeback_cnt = 0;
+    cond_broadcast (&writeback_done, &frame_lock);
+  }
+  for (size_t i = 0; i < cnt; ++i)
+    frametb_free_page (po[i].f);
+  return true;
+}
 
-  /* Clear in the frame table. */
-  ftb->upages[slot] = NULL;
-  return slot;
+/** Page-out thread. */
+static void
+vm_reclaimer (void *aux UNUSED)
+{
+  lock_acquire (&frame_lock);
+  for (;;)
+    {
+      /* If every frame is pinned, try again on the next fault. */
+      cond_wait (&reclaim_work, &frame_lock);
+      size_t free_cnt;
+      while ((free_cnt = frametb_free_cnt ()) < reclaim_high
+             && vm_reclaim_batch (reclaim_high - free_cnt))
+        continue;
+    }
+}
+
+/** Start the page-out thread. */
+void
+vm_reclaim_init (void)
+{
+  const size_t cnt = palloc_user_cnt ();
+  reclaim_low = RECLAIM_LOW < cnt / 8 ? RECLAIM_LOW : cnt / 8;
+  reclaim_high = RECLAIM_HIGH < cnt / 4 ? RECLAIM_HIGH : cnt / 4;
+
+  cond_init (&writeback_done);
+  cond_init (&reclaim_work);
+  if (thread_create ("pageout", PRI_DEFAULT, vm_reclaimer, NULL)
+      == TID_ERROR)
+    PANIC ("cannot create page-out thread");
+}
+
+/** +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-
+ *                       Virtual Memory Utility
+  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+- */
+
+/** Allocate a frame for uaddr of the current process, evicting a page
+   if the user pool is exhausted. The frame is pinned until installed.
+   Must hold frame_lock. */
+static void *
+vm_frame_alloc (int zero, void *uaddr)
+{
+  struct thread *cur = thread_current ();
+  struct process_meta *meta = cur->meta;
+  frametb_fault (meta);
+
+  /* Try the user pool first, and have the page-out thread refill it
+     before it runs dry. */
+  void *page = frametb_get_page (uaddr, zero);
+  if (frametb_free_cnt () < reclaim_low)
+    cond_signal (&reclaim_work, &frame_lock);
+  if (page != NULL) {
+    /* Success! */
+    return page;
+  }
+
+  /* Must evict a page for allocation. Within its quota the process
+     takes a frame from those over theirs, at its quota it replaces
+     one of its own. Failing that, any frame will do. */
+  struct frame *f;
+  if (meta->frame_cnt < meta->frame_quota)
+    f = vm_evict (NULL, true);
+  else
+    f = vm_evict (cur, false);
+  if (f == NULL)
+    f = vm_evict (NULL, false);
+  if (f == NULL)
+    PANIC ("user pool out of page");
+  frametb_claim (f, uaddr);
+
+  /* Check and initialize the page */
+  if (zero)
+    memset (f->kpage, 0, PGSIZE);
+  return f->kpage;
+}
+
+/** Map upage to the frame kpage in the current pagedir, and unpin the
+   frame. Must hold frame_lock. */
+static bool
+vm_frame_install (void *upage, void *kpage, bool writable)
+{
+  struct thread *cur = thread_current ();
+  struct frame *f = frametb_lookup (kpage);
+  if (!pagedir_set_page (cur->pagedir, upage, kpage, writable)) {
+    frametb_free_page (f);
+    return false;
+  }
+  f->pinned--;
+  return true;
 }
 
 /** 
  * Allocate a page private to the process. Will NOT make the mapping in the
- * page directory.
+ * page directory, the page stays pinned until vm_install_page.
  * @param zero if true, initialize the allocated page with 0.
  * @param uaddr user virtual address for the page.
  */
 void *
 vm_alloc_page (int zero, void *uaddr)
 {
-  struct thread *cur = thread_current ();
-  struct process_meta *meta = cur->meta;
 #ifdef ROBUST
-  ASSERT (meta != NULL);
+  ASSERT (thread_current ()->meta != NULL);
   ASSERT (uaddr != NULL);
 #endif
+  lock_acquire (&frame_lock);
+  void *page = vm_frame_alloc (zero, uaddr);
+  lock_release (&frame_lock);
 
-  /* Try frame table first */
-  void *page = frametb_get_page (&meta->frametb, uaddr, zero);
-  if (page != NULL) {
-    /* Success! */
-    return page;
-  }
+  /* NOTE: This method do not create mapping in pagedir! */
+  return page;
+}
 
-  /* Must evict a page for allocation */
-  unsigned int slot = vm_evict (cur);
-#ifdef ROBUST
-  ASSERT ((int)slot < meta->frametb.free_ptr);
-#endif
+/** Install a page from vm_alloc_page at upage, and let it be evicted
+   from now on. On failure the page is freed.
+   @return true if successful. */
+bool
+vm_install_page (void *upage, void *kpage, bool writable)
+{
+  lock_acquire (&frame_lock);
+  bool success = vm_frame_install (upage, kpage, writable);
+  lock_release (&frame_lock);
+  return success;
+}
 
-  /* Record new user address in frame table. */
-  meta->frametb.upages[slot] = pg_round_down (uaddr);
+/** Swap-in read-ahead: gather free frames for the pages after upage
+   that were swapped to the slots after sec, so that they are read in
+   one transfer with it. pages[0] holds the frame of upage, the rest
+   are filled up to SWAP_READAHEAD in all. Stops at the first page
+   that is elsewhere, in writeback, or when free frames run low. Must
+   hold frame_lock.
+   @return number of pages, counting upage. */
+static size_t
+vm_swap_cluster (void *upage, unsigned int sec, void *pages[])
+{
+  struct thread *cur = thread_current ();
+  size_t cnt;
 
-  /* Check and initialize the page */
-  if (zero)
-    memset (meta->frametb.pages[slot], 0, PGSIZE);
+  for (cnt = 1; cnt < SWAP_READAHEAD; ++cnt)
+    {
+      void *up = pg_round_down (upage) + cnt * PGSIZE;
+      if (!is_user_vaddr (up) || frametb_free_cnt () <= reclaim_low
+          || vm_writeback_busy (cur, up))
+        break;
 
-  /* NOTE: This method do not create mapping in pagedir! */
-  return meta->frametb.pages[slot];
+      uint32_t *ste = swaptb_lookup (cur->pagedir, up);
+      if (ste == NULL
+          || ste_get_blockno (*ste) != sec + cnt * SECTORS_PER_PAGE)
+        break;
+
+      pages[cnt] = frametb_get_page (up, 0);
+      if (pages[cnt] == NULL)
+        break;
+    }
+  return cnt;
+}
+
+/** Fault-around: load the other pages of the FAULT_AROUND aligned
+   window around upage that map the same file as mf, so that touching
+   them takes no fault. Pages already present or in swap are skipped.
+   Stops at a page in writeback, or when free frames run low. Must
+   hold frame_lock. */
+static void
+vm_fault_around (void *upage, struct map_file *mf)
+{
+  struct thread *cur = thread_current ();
+  struct process_meta *meta = cur->meta;
+  struct inode *inode = file_get_inode (mf->fobj);
+  void *start = (void *) ROUND_DOWN ((uintptr_t) upage,
+                                     FAULT_AROUND * PGSIZE);
+
+  for (int i = 0; i < FAULT_AROUND; ++i)
+    {
+      void *up = start + i * PGSIZE;
+      if (up == pg_round_down (upage) || !is_user_vaddr (up)
+          || pagedir_get_page (cur->pagedir, up) != NULL)
+        continue;
+      if (frametb_free_cnt () <= reclaim_low
+          || vm_writeback_busy (cur, up))
+        break;
+
+      if (swaptb_lookup (cur->pagedir, up) != NULL)
+        continue;
+      struct map_file *near = map_file_lookup (meta->map_file_tb, up);
+      if (near == NULL || file_get_inode (near->fobj) != inode)
+        continue;
+
+      void *kpage = frametb_get_page (up, 0);
+      if (kpage == NULL)
+        break;
+      if (!map_file_init_page (near, up, kpage)) {
+        frametb_free_page (frametb_lookup (kpage));
+        break;
+      }
+      if (!vm_frame_install (up, kpage, near->writable))
+        break;
+    }
 }
 
 /** Fetch a user page(used on a page fault, will create mapping in pagedir).
@@ -126,76 +475,163 @@ void *
 vm_fetch_page (void *upage)
 {
   if (upage == NULL || !is_user_vaddr (upage)) {
-    goto vm_not_found;
+    return NULL;
   }
 
   /* Fetch vm members */
   struct thread *cur = thread_current ();
   struct process_meta *meta = cur->meta;
-  struct frame_table *ftb = &meta->frametb;
-  struct swap_table_root *swaptb = meta->swaptb;
-
-  /* Here I do not want to do the following:
-    The reason is obvious, on a page fault, the page will definitely not
-    be in the page directory. */
-#if 0
-  void *ret = pagedir_get_page (upage);
-  if (ret)
-    return ret;
-#endif
+  void *page = NULL;
+
+  /* The lock is held across the disk reads below: a page we find in
+     swap cannot be half written by an eviction. */
+  lock_acquire (&frame_lock);
+  vm_writeback_wait (cur, upage);
+
+  /* One walk of the page table tells where the page is. Another
+     process may have paged it in for us meanwhile, e.g. by a copy
+     from the kernel. */
+  uint32_t *pte = pagedir_lookup (cur->pagedir, upage);
+  if (pte != NULL && (*pte & PTE_P) != 0) {
+    page = pte_get_page (*pte) + pg_ofs (upage);
+    goto vm_done;
+  }
+
   /* Try the swap device first. Why? Just consider the following scenario:
     1. a page is located in the bss area;
     2. it was evicted at some time, for it's dirty, it was written to swap dev;
     3. both the swap table and file mapping table contains a copy of the page,
       but only that in the swap table is up-to-date. */
   
-  unsigned int *ste = swaptb_lookup (swaptb, upage);
-  if (ste != NULL && (*ste & STE_V) != 0)
+  if (pte != NULL && ste_is_swap (*pte))
     {
       /* Get the sector no */
-      unsigned sec = ste_get_blockno (*ste);
+      unsigned sec = ste_get_blockno (*pte);
 
       /* Allocate a page */
-      void *page = vm_alloc_page (0, upage);
+      page = vm_frame_alloc (0, upage);
       ASSERT (page != NULL); 
 
-      /* Read the content, and free the swap device */
-      swaptb_read_page (sec, page);
-      swaptb_free_sec (sec);
+      /* Read the content, along with the pages after it that went to
+         the following slots */
+      void *pages[SWAP_READAHEAD];
+      pages[0] = page;
+      const size_t cnt = vm_swap_cluster (upage, sec, pages);
+      swaptb_read_pages (sec, pages, cnt);
 
-      /* Install the page */
-      pagedir_set_page (cur->pagedir, upage, page, 1);
+      for (size_t i = 0; i < cnt; ++i)
+        {
+          void *up = pg_round_down (upage) + i * PGSIZE;
 
-      /* Manually unmap the page in the swap table */
-      *ste = 0x0;
+          /* Install the page, which replaces the swap entry in the
+             PTE. If that fails, the swap copy stays. */
+          if (!vm_frame_install (up, pages[i], 1)) {
+            if (i == 0)
+              page = NULL;
+            continue;
+          }
 
-      return page;
+          /* Free the swap device. The swap copy is gone, so the page
+             counts as dirty: evicting it must write it out again. */
+          swaptb_free_sec (sec + i * SECTORS_PER_PAGE);
+          pagedir_set_dirty (cur->pagedir, up, true);
+        }
+      goto vm_done;
     }
   
   /* Not successful, try file mapping instead. */
-  struct map_file *mf = map_file_lookup (meta->map_file_rt, upage);
+  struct map_file *mf = map_file_lookup (meta->map_file_tb, upage);
   if (mf == NULL)
-    goto vm_not_found;
-  void *page = vm_alloc_page (0, upage);
-  if (map_file_init_page (mf, page))
+    goto vm_done;
+  page = vm_frame_alloc (0, upage);
+  if (map_file_init_page (mf, upage, page))
     {
       /* Record the mapping in the pagedir */
-      pagedir_set_page (cur->pagedir, upage, page, mf->writable);
-      return page;
+      if (vm_frame_install (upage, page, mf->writable))
+        vm_fault_around (upage, mf);
+      else
+        page = NULL;
     }
   else 
     {
-      /* Clear the page in the mapping */
-      for (int i = 0; i < ftb->free_ptr; ++i) {
-        if (ftb->pages[i] == page)
-          {
-            ftb->upages[i] = NULL;
-          }
-      }
+      /* Give the frame back */
+      frametb_free_page (frametb_lookup (page));
+      page = NULL;
+    }
+
+vm_done:
+  lock_release (&frame_lock);
+  return page;
+}
+
+/** Pin the frame of user page upage in pagedir pd so that no process
+ * evicts it, e.g. while the kernel copies through its kernel alias.
+ * @param write if set, the page is about to be modified through the
+ * alias, which the dirty bit in pd would not notice.
+ * @return the kernel alias, NULL if upage is not in memory.
+ */
+void *
+vm_pin (uint32_t *pd, void *upage, int write)
+{
+  lock_acquire (&frame_lock);
+  void *kaddr = pagedir_get_page (pd, upage);
+  if (kaddr != NULL) {
+    frametb_lookup (kaddr)->pinned++;
+    pagedir_set_accessed (pd, upage, true);
+    if (write)
+      pagedir_set_dirty (pd, upage, true);
+  }
+  lock_release (&frame_lock);
+  return kaddr;
+}
+
+/** Undo vm_pin, given any address in the kernel alias. */
+void
+vm_unpin (void *kaddr)
+{
+  lock_acquire (&frame_lock);
+  struct frame *f = frametb_lookup (kaddr);
+  ASSERT (f->pinned > 0);
+  f->pinned--;
+  lock_release (&frame_lock);
+}
+
+/** Drop cnt user pages from upage of the current process from memory,
+   writing them back to the file of mf first if they are dirty. The TLB
+   is invalidated once for the whole range, before frame_lock is
+   released and the frames can be handed out again. */
+void
+vm_free_pages (void *upage, size_t cnt, struct map_file *mf)
+{
+  uint32_t *pgtbl = thread_current ()->pagedir;
+
+  lock_acquire (&frame_lock);
+  for (size_t i = 0; i < cnt; ++i)
+    {
+      uint8_t *page = (uint8_t *) upage + i * PGSIZE;
+      vm_writeback_wait (thread_current (), page);
+      void *kpage = pagedir_get_page (pgtbl, page);
+      if (kpage == NULL)
+        continue;
+      if (mf != NULL && pagedir_is_dirty (pgtbl, page))
+        file_write_at (mf->fobj, kpage, mf_page_bytes (mf, page),
+                       mf_page_ofs (mf, page));
+      pagedir_clear_page_lazy (pgtbl, page);
+      frametb_free_page (frametb_lookup (kpage));
     }
+  pagedir_invalidate (pgtbl, upage, cnt);
+  lock_release (&frame_lock);
+}
 
-vm_not_found:
-  return NULL;
+/** Free the frames of the current process, which is exiting. After
+   this no eviction looks at its tables any more. */
+void
+vm_exit (void)
+{
+  lock_acquire (&frame_lock);
+  vm_writeback_wait (thread_current (), NULL);
+  frametb_free (thread_current ());
+  lock_release (&frame_lock);
 }
 
 /** returns true if upage is present, regardless of where it actually is. */
@@ -207,21 +643,24 @@ vm_is_present (void *upage)
   struct process_meta *meta = cur->meta;
   uint32_t *pgtbl = cur->pagedir;
 
+  /* Evictions update our tables from other processes. */
+  int present = 0;
+  lock_acquire (&frame_lock);
+
   /** Look into page table. */
   if (pagedir_get_page (pgtbl, upage) != NULL)
-    return 1;
+    present = 1;
 
   /* Look into swap device. */
-  struct swap_table_root *swaptb = meta->swaptb;
-  unsigned int *ste = (swaptb_lookup (swaptb, upage));
-  if (ste != NULL && (*ste & STE_V) != 0)
-    return 1;
+  if (swaptb_lookup (pgtbl, upage) != NULL)
+    present = 1;
 
   /* Look into map file table. */
-  struct map_file *mf = map_file_lookup (meta->map_file_rt, upage);
+  struct map_file *mf = map_file_lookup (meta->map_file_tb, upage);
   if (mf != NULL)
-    return 1;
+    present = 1;
 
   /* Nowhere can the page be found! */
-  return 0;
+  lock_release (&frame_lock);
+  return present;
 }